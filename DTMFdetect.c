@@ -41,158 +41,6 @@ would encourage you to show your appreciation by sharing some of your own
 knowledge with Phrack.    
 */
 
-/* <++> dtmf/detect.h */
-
-/* 
- *
- * goertzel aglorithm, find the power of different
- * frequencies in an N point DFT.
- *
- * ftone/fsample = k/N   
- * k and N are integers.  fsample is 8000 (8khz)
- * this means the *maximum* frequency resolution
- * is fsample/N (each step in k corresponds to a
- * step of fsample/N hz in ftone)
- *
- * N was chosen to minimize the sum of the K errors for
- * all the tones detected...  here are the results :
- *
- * Best N is 240, with the sum of all errors = 3.030002
- * freq  freq actual   k     kactual  kerr
- * ---- ------------  ------ ------- -----
- *  350 (366.66667)   10.500 (11)    0.500
- *  440 (433.33333)   13.200 (13)    0.200
- *  480 (466.66667)   14.400 (14)    0.400
- *  620 (633.33333)   18.600 (19)    0.400
- *  697 (700.00000)   20.910 (21)    0.090
- *  700 (700.00000)   21.000 (21)    0.000
- *  770 (766.66667)   23.100 (23)    0.100
- *  852 (866.66667)   25.560 (26)    0.440
- *  900 (900.00000)   27.000 (27)    0.000
- *  941 (933.33333)   28.230 (28)    0.230
- * 1100 (1100.00000)  33.000 (33)    0.000
- * 1209 (1200.00000)  36.270 (36)    0.270
- * 1300 (1300.00000)  39.000 (39)    0.000
- * 1336 (1333.33333)  40.080 (40)    0.080
- **** I took out 1477.. too close to 1500
- * 1477 (1466.66667)  44.310 (44)    0.310
- ****
- * 1500 (1500.00000)  45.000 (45)    0.000
- * 1633 (1633.33333)  48.990 (49)    0.010
- * 1700 (1700.00000)  51.000 (51)    0.000
- * 2400 (2400.00000)  72.000 (72)    0.000
- * 2600 (2600.00000)  78.000 (78)    0.000
- *
- * notice, 697 and 700hz are indestinguishable (same K)
- * all other tones have a seperate k value.  
- * these two tones must be treated as identical for our
- * analysis.
- *
- * The worst tones to detect are 350 (error = 0.5, 
- * detet 367 hz) and 852 (error = 0.44, detect 867hz). 
- * all others are very close.
- *
- */
-
-#define FSAMPLE  8000
-#define N        240
-
-int k[] = { 11, 13, 14, 19, 21, 23, 26, 27, 28, 33, 36, 39, 40,
- /*44,*/ 45, 49, 51, 72, 78, };
-
-/* coefficients for above k's as:
- *   2 * cos( 2*pi* k/N )
- */
-float coef[] = {
-1.917639, 1.885283, 1.867161, 1.757634, 
-1.705280, 1.648252, 1.554292, 1.520812, 1.486290, 
-1.298896, 1.175571, 1.044997, 1.000000, /* 0.813473,*/ 
-0.765367, 0.568031, 0.466891, -0.618034, -0.907981,  };
-
-#define X1    0    /* 350 dialtone */
-#define X2    1    /* 440 ring, dialtone */
-#define X3    2    /* 480 ring, busy */
-#define X4    3    /* 620 busy */
-
-#define R1    4    /* 697, dtmf row 1 */
-#define R2    5    /* 770, dtmf row 2 */
-#define R3    6    /* 852, dtmf row 3 */
-#define R4    8    /* 941, dtmf row 4 */
-#define C1   10    /* 1209, dtmf col 1 */
-#define C2   12    /* 1336, dtmf col 2 */
-#define C3   13    /* 1477, dtmf col 3 */
-#define C4   14    /* 1633, dtmf col 4 */
-
-#define B1    4    /* 700, blue box 1 */
-#define B2    7    /* 900, bb 2 */
-#define B3    9    /* 1100, bb 3 */
-#define B4   11    /* 1300, bb4 */
-#define B5   13    /* 1500, bb5 */
-#define B6   15    /* 1700, bb6 */
-#define B7   16    /* 2400, bb7 */
-#define B8   17    /* 2600, bb8 */
-
-#define NUMTONES 18 
-
-/* values returned by detect 
- *  0-9     DTMF 0 through 9 or MF 0-9
- *  10-11   DTMF *, #
- *  12-15   DTMF A,B,C,D
- *  16-20   MF last column: C11, C12, KP1, KP2, ST
- *  21      2400
- *  22      2600
- *  23      2400 + 2600
- *  24      DIALTONE
- *  25      RING
- *  26      BUSY
- *  27      silence
- *  -1      invalid
- */
-#define D0    0
-#define D1    1
-#define D2    2
-#define D3    3
-#define D4    4
-#define D5    5
-#define D6    6
-#define D7    7
-#define D8    8
-#define D9    9
-#define DSTAR 10
-#define DPND  11
-#define DA    12
-#define DB    13
-#define DC    14
-#define DD    15
-#define DC11  16
-#define DC12  17
-#define DKP1  18
-#define DKP2  19
-#define DST   20
-#define D24   21 
-#define D26   22
-#define D2426 23
-#define DDT   24
-#define DRING 25
-#define DBUSY 26
-#define DSIL  27
-
-/* translation of above codes into text */
-char *dtran[] = {
-  "0", "1", "2", "3", "4", "5", "6", "7", "8", "9",
-  "*", "#", "A", "B", "C", "D", 
-  "+C11 ", "+C12 ", " KP1+", " KP2+", "+ST ",
-  " 2400 ", " 2600 ", " 2400+2600 ",
-  " DIALTONE ", " RING ", " BUSY ","" };
-
-#define RANGE  0.1           /* any thing higher than RANGE*peak is "on" */
-#define THRESH 100.0         /* minimum level for the loudest tone */
-#define FLUSH_TIME 100       /* 100 frames = 3 seconds */
-
-/*<-->
-<++> dtmf/detect.c
-*/
-
 /*
  * detect.c
  * This program will detect MF tones and normal
@@ -205,230 +53,554 @@ char *dtran[] = {
  * can use either signed or unsigned samples according
  * to a compile time option:
  *
- *    cc  -DUNSIGNED detect.c -o detect
+ *    cc  -DUNSIGNED detect.c detector.c -o detect -lm
  *
  * for unsigned input (soundblaster) and:
  *
- *    cc  detect.c -o detect
+ *    cc  detect.c detector.c -o detect -lm
  *
  * for signed input (amiga samples)
  * if you dont want flushes,  -DNOFLUSH
+ * for per stage frame counts on stderr,  -DSTATS
+ *
+ *    detect [-p profile] [input [output]]
+ *    detect [-p profile] -m input...
+ *    detect [-p profile] [-S speed] -r capture
+ *
+ * the profile (-p full, dtmf, mf, cp, cid or fax) picks the
+ * tones looked for, see profiles[].  full is the default.
+ * -c also decodes bell 202 caller ID, in the same pass.
+ * -e gives a DTMF digit from part of a frame, before the
+ * frame is all in, and takes it back ('~') if the full
+ * frame disagrees (see read_early).
+ * -f json or bin writes each tone as a record with its
+ * time and power instead of text (see frame_events and
+ * struct record), -F sets how often output is flushed.
+ * -P file dumps the power of every tone in every frame,
+ * with its result, for power to read (see spec_frame).
+ * -L sets the levels, adaptive thresholds and the DTMF
+ * twist and talk-off checks (see level_frame), as in
+ * -L adapt=20,twist=8,rtwist=4,share=0.6.  the talk-off
+ * checks are on, -L share=0,harm=0 turns them off.
+ * with -m each input is a channel of its own, they are
+ * decoded NCHAN at a time (-DNCHAN=16 for wider batches).
+ * an input that is a .wav file is decoded channel by
+ * channel, each tagged with its number (see wav_open).
+ * a .wav above 8 kHz (16, 44.1, 48) is resampled first,
+ * its event times are of the file less the filter's delay.
+ * -R file with -m captures the input, with the time each
+ * frame came, and -r file decodes such a capture as -m
+ * does, at -S times the speed it came (0 as fast as it
+ * can), then gives the throughput and the latency of a
+ * frame on stderr (see replay_open).
+ * the batches of -m and a .wav run on the fastest of the
+ * kernels for the CPU, found by timing them the first
+ * time and kept for the host (see det_tune), -K sets one.
+ * -T file traces the read, decode and write of every
+ * frame to file, as chrome trace JSON (see trace_span);
+ * the static probes of detect.h are there for tracers
+ * outside.
+ *
+ *    cc  -DTHREADS detect.c detector.c -o detect -lm -lpthread
+ *
+ * adds -t n, to decode on n worker threads with input
+ * and output on threads of their own, and -s, a scan of
+ * many recordings at once (see scan_to_ascii), names on
+ * stdin or as arguments.  -DURING reads the scan with
+ * io_uring, else (or if the kernel says no) with a pool
+ * of pread() threads.  -x index keeps the scan's events
+ * in an index (see ix_save), for query to search, -X
+ * index to decode again inputs it already has.
+ *
+ *    cc  -DMETRICS detect.c detector.c -o detect -lm
+ *
+ * adds -M file, prometheus metrics written to file every
+ * -i seconds (see metrics_dump).  without it none of the
+ * timing is compiled in.
  * 
  *                            Tim N.
  */
 
+#ifdef THREADS
+#define _GNU_SOURCE            /* O_DIRECT, see scan_open() */
+#endif
 #include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
 #include <math.h>
-/*
- #include "detect.h"
- */
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef THREADS
+#include <pthread.h>
+#include <sched.h>
+#ifdef URING
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#endif
+#include "detect.h"
+
+#ifdef METRICS
+#  define METRICS_TICK() metrics_tick()
+#else
+#  define METRICS_TICK()
+#endif
 
 /*
- * calculate the power of each tone according
- * to a modified goertzel algorithm described in
- *  _digital signal processing applications using the
- *  ADSP-2100 family_ by Analog Devices
- *
- * input is 'data',  N sample values
+ * tracing.
  *
- * ouput is 'power', NUMTONES values
- *  corresponding to the power of each tone 
+ * the probes in detect.h are for a tracer outside the
+ * process.  -T file is one inside it: every thread keeps
+ * its last TRACE_SLOTS spans, the read, decode and write
+ * of each frame or batch as the metrics time them, in a
+ * ring of its own, and at the end they are written to
+ * file as chrome trace JSON (chrome://tracing, perfetto).
+ * when it is off a span is a test of 'tracing'.
  */
+#define TRACE_SLOTS  65536     /* per thread, a power of 2 */
+
+struct span {
+  long long start;        /* ns */
+  int dur;
+  short what;             /* S_READ ... */
+  short n;                /* channels, for a batch */
+  int chan, x;            /* the first channel, and the result of one */
+};
+
+struct trace {
+  struct trace *next;
+  int tid;
+  unsigned long n;        /* spans so far, the last TRACE_SLOTS kept */
+  struct span span[TRACE_SLOTS];
+};
+
+int tracing;                   /* -T */
+char *trace_file;
+struct trace *all_traces;
+LOCAL struct trace *my_trace;
+char *span_name[] = { "read", "decode", "write" };
+
+#define T_VAR(t)          long long t
+#define T_START(t)        ((t) = tracing? now_ns(): 0)
+#define T_SPAN(s,t,c,n,x) (tracing? trace_span(s,t,c,n,x): 0)
+
+/* a span of stage s from 'start' to now */
+trace_span(s, start, chan, n, x)
+int s;
+long long start;
+int chan, n, x;
+{
+  struct trace *tp = my_trace;
+  struct span *sp;
 
-calc_power(data,power)
-#ifdef UNSIGNED
-unsigned char *data;
-#else
-char *data;
-#endif
-float *power;
+  if(!tp) {                  /* this thread's first */
+    if(!(tp = (struct trace *)calloc(1, sizeof(*tp))))
+      return(0);
+    do
+      tp->next = all_traces;
+    while(!__sync_bool_compare_and_swap(&all_traces, tp->next, tp));
+    tp->tid = tp->next? tp->next->tid + 1: 1;
+    my_trace = tp;
+  }
+  sp = &tp->span[tp->n++ & (TRACE_SLOTS-1)];
+  sp->start = start;
+  sp->dur = now_ns() - start;
+  sp->what = s;
+  sp->chan = chan;
+  sp->n = n;
+  sp->x = x;
+  return(0);
+}
+
+/* every thread's spans into 'trace_file', once they are done */
+trace_write()
 {
-  float u0[NUMTONES],u1[NUMTONES],t,in;
-  int i,j;
-  
-  for(j=0; j<NUMTONES; j++) {
-    u0[j] = 0.0;
-    u1[j] = 0.0;
+  struct trace *tp;
+  struct span *sp;
+  unsigned long i;
+  char *sep = "";
+  FILE *fp;
+
+  if(!(fp = fopen(trace_file, "w"))) {
+    perror(trace_file);
+    return(-1);
   }
-  for(i=0; i<N; i++) {   /* feedback */
-#ifdef UNSIGNED
-    in = ((int)data[i] - 128) / 128.0;
-#else
-    in = data[i] / 128.0;
-#endif
-    for(j=0; j<NUMTONES; j++) {
-      t = u0[j];
-      u0[j] = in + coef[j] * u0[j] - u1[j];
-      u1[j] = t;
+  fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  for(tp=all_traces; tp; tp=tp->next)
+    for(i=(tp->n > TRACE_SLOTS)? tp->n-TRACE_SLOTS: 0; i<tp->n; i++) {
+      sp = &tp->span[i & (TRACE_SLOTS-1)];
+      fprintf(fp, "%s{\"name\":\"%s\",\"cat\":\"dtmf\",\"ph\":\"X\","
+              "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,"
+              "\"args\":{\"chan\":%d,\"n\":%d", sep, span_name[sp->what],
+              sp->start / 1e3, sp->dur / 1e3, (int)getpid(), tp->tid,
+              sp->chan, sp->n);
+      if(sp->n == 1 && sp->what == S_DECODE)
+        fprintf(fp, ",\"result\":%d", sp->x);
+      fprintf(fp, "}}");
+      sep = ",\n";
     }
+  fprintf(fp, "\n]}\n");
+  if(fclose(fp) == EOF) {
+    perror(trace_file);
+    return(-1);
   }
-  for(j=0; j<NUMTONES; j++)   /* feedforward */
-    power[j] = u0[j] * u0[j] + u1[j] * u1[j] - coef[j] * u0[j] * u1[j]; 
   return(0);
 }
 
+read_frame(fd,buf)
+int fd;
+char *buf;
+{
+  return(read_part(fd,buf,0,N));
+}
+
+/* read samples 'from' up to 'to' of a frame */
+read_part(fd,buf,from,to)
+int fd;
+char *buf;
+int from, to;
+{
+  int i,x;
+
+  for(i=from; i<to; ) {
+    x = read(fd, &buf[i], to-i);
+    if(x <= 0) 
+      return(0);
+    i += x;
+  } 
+  return(1);
+}
 
 /*
- * detect which signals are present.
+ * events.
  *
- * return values defined in the include file
- * note: DTMF 3 and MF 7 conflict.  To resolve
- * this the program only reports MF 7 between
- * a KP and an ST, otherwise DTMF 3 is returned
+ * with text output (the default) an event is what gets
+ * printed: a digit or tone as it starts, DSIL for the end
+ * of a line after FLUSH_TIME frames of silence.
+ *
+ * with json or binary output an event is a whole tone,
+ * sent when it ends, with its first and one past its
+ * last sample (offsets from the start of the channel, to
+ * the frame) and the power of its two strongest tones
+ * at their peak.  the tones reported are the ones text
+ * output would print.
  */
-decode(data)
-char *data;
+#define F_TEXT  0
+#define F_JSON  1
+#define F_BIN   2
+
+int out_format = F_TEXT;
+int callerid = 0;              /* -c */
+struct specfile *the_dump;     /* -P */
+struct levels levels;          /* -L */
+char *levels_arg;
+
+/* det_init(), and what the options ask of a channel */
+chan_init(dp,pp,chan)
+struct detector *dp;
+struct profile *pp;
+int chan;
 {
-  float power[NUMTONES],thresh,maxpower;
-  int on[NUMTONES],on_count;
-  int bcount, rcount, ccount;
-  int row, col, b1, b2, i;
-  int r[4],c[4],b[8];
-  static int MFmode=0;
-  
-  calc_power(data,power);
-  for(i=0, maxpower=0.0; i<NUMTONES;i++)
-    if(power[i] > maxpower)
-      maxpower = power[i]; 
-/*
-for(i=0;i<NUMTONES;i++) 
-  printf("%f, ",power[i]);
-printf("\n");
-*/
+  det_init(dp,pp,chan);
+  dp->whole = out_format != F_TEXT;
+  dp->callerid = callerid;
+  dp->dump = the_dump;
+  det_levels(dp, &levels);
+  return(0);
+}
 
-  if(maxpower < THRESH)  /* silence? */ 
-    return(DSIL);
-  thresh = RANGE * maxpower;    /* allowable range of powers */
-  for(i=0, on_count=0; i<NUMTONES; i++) {
-    if(power[i] > thresh) { 
-      on[i] = 1;
-      on_count ++;
-    } else
-      on[i] = 0;
-  }
+/*
+ * the sink all events are written to.
+ *
+ * writes are collected in buf and go out in one piece
+ * according to the flush policy: after every event
+ * (P_EVENT, as the text output has always done), only
+ * when buf is full (P_FULL) or once the oldest of them
+ * is 'policy' milliseconds old.
+ */
+#define P_EVENT   0
+#define P_FULL   -1
+#define SINK_BUF  65536
+
+struct sink {
+  FILE *fp;
+  int policy;
+  int len;
+  long due;               /* when to flush, for a time policy */
+  long events, writes;
+  char buf[SINK_BUF];
+};
 
 /*
-printf("%4d: ",on_count);
-for(i=0;i<NUMTONES;i++)
-  putchar('0' + on[i]);
-printf("\n");
-*/
+ * binary output is a header, then a struct record
+ * per event, in the byte order of the host.  a VCID
+ * record is followed by the CID_TEXT bytes of its text.
+ * the flags of an early decision are in the second
+ * byte of the code.
+ */
+struct record {
+  int chan;
+  int code;
+  long long start, end;
+  float peak[2];
+};
+char bin_magic[4] = { 'D', 'T', 'E', 'V' };
+#define BIN_VERSION  3
+
+long sink_now()
+{
+  struct timespec ts;
 
-  if(on_count == 1) {
-    if(on[B7]) 
-      return(D24);
-    if(on[B8])
-      return(D26);
-    return(-1);
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return(ts.tv_sec * 1000L + ts.tv_nsec / 1000000);
+}
+
+sink_flush(sp)
+struct sink *sp;
+{
+  if(sp->len) {
+    fwrite(sp->buf, 1, sp->len, sp->fp);
+    sp->writes++;
+    sp->len = 0;
   }
- 
-  if(on_count == 2) {
-    if(on[X1] && on[X2])
-      return(DDT);
-    if(on[X2] && on[X3])
-      return(DRING);
-    if(on[X3] && on[X4])
-      return(DBUSY);
-    
-    b[0]= on[B1]; b[1]= on[B2]; b[2]= on[B3]; b[3]= on[B4];
-    b[4]= on[B5]; b[5]= on[B6]; b[6]= on[B7]; b[7]= on[B8];
-    c[0]= on[C1]; c[1]= on[C2]; c[2]= on[C3]; c[3]= on[C4];
-    r[0]= on[R1]; r[1]= on[R2]; r[2]= on[R3]; r[3]= on[R4];
-
-    for(i=0, bcount=0; i<8; i++) {
-      if(b[i]) {
-        bcount++;
-        b2 = b1;
-        b1 = i;
-      }
-    }
-    for(i=0, rcount=0; i<4; i++) {
-      if(r[i]) {
-        rcount++;
-        row = i;
-      }
-    }
-    for(i=0, ccount=0; i<4; i++) {
-      if(c[i]) {
-        ccount++;
-        col = i;
-      }
-    }
+  fflush(sp->fp);
+  return(0);
+}
 
-    if(rcount==1 && ccount==1) {   /* DTMF */
-      if(col == 3)  /* A,B,C,D */
-        return(DA + row);
-      else {
-        if(row == 3 && col == 0 ) 
-           return(DSTAR);
-        if(row == 3 && col == 2 )
-           return(DPND);
-        if(row == 3)
-           return(D0);
-        if(row == 0 && col == 2) {   /* DTMF 3 conflicts with MF 7 */
-          if(!MFmode)
-            return(D3);
-        } else 
-          return(D1 + col + row*3);
-      }
-    }
+sink_put(sp, p, n)
+struct sink *sp;
+char *p;
+int n;
+{
+  if(sp->len + n > SINK_BUF)
+    sink_flush(sp);
+  if(!sp->len && sp->policy > 0)
+    sp->due = sink_now() + sp->policy;
+  memcpy(sp->buf + sp->len, p, n);
+  sp->len += n;
+  return(0);
+}
 
-    if(bcount == 2) {       /* MF */
-      /* b1 has upper number, b2 has lower */
-      switch(b1) {
-        case 7: return( (b2==6)? D2426: -1); 
-        case 6: return(-1);
-        case 5: if(b2==2 || b2==3)  /* KP */
-                  MFmode=1;
-                if(b2==4)  /* ST */
-                  MFmode=0; 
-                return(DC11 + b2);
-        /* MF 7 conflicts with DTMF 3, but if we made it
-         * here then DTMF 3 was already tested for 
-         */
-        case 4: return( (b2==3)? D0: D7 + b2);
-        case 3: return(D4 + b2);
-        case 2: return(D2 + b2);
-        case 1: return(D1);
-      }
-    }
-    return(-1);
+sink_open(sp, fp, policy)
+struct sink *sp;
+FILE *fp;
+int policy;
+{
+  unsigned short hdr[2];
+
+  sp->fp = fp;
+  sp->policy = policy;
+  sp->len = 0;
+  sp->events = sp->writes = 0;
+  if(out_format == F_BIN) {
+    hdr[0] = BIN_VERSION;
+    hdr[1] = sizeof(struct record);
+    sink_put(sp, bin_magic, 4);
+    sink_put(sp, (char *)hdr, 4);
   }
+  return(0);
+}
 
-  if(on_count == 0)
-    return(DSIL);
-  return(-1); 
+/* called now and then by the output side, for a time policy */
+sink_tick(sp)
+struct sink *sp;
+{
+  if(sp->policy > 0 && sp->len && sink_now() >= sp->due)
+    sink_flush(sp);
+  return(0);
 }
 
-read_frame(fd,buf)
-int fd;
+/*
+ * the name of a code for json, dtran[] without
+ * the spacing and the plus signs
+ */
+char *code_name(code, buf)
+int code;
 char *buf;
 {
-  int i,x;
+  char *p, *q;
+
+  for(p=dtran[code]; *p == ' ' || *p == '+'; p++)
+    ;
+  strcpy(buf, p);
+  for(q=buf+strlen(buf); q > buf && (q[-1] == ' ' || q[-1] == '+'); )
+    *--q = '\0';
+  return(buf);
+}
 
-  for(i=0; i<N; ) {
-    x = read(fd, &buf[i], N-i);
-    if(x <= 0) 
+/*
+ * write an event
+ *
+ * as text a channel of several has each of its
+ * results on a line of its own, tagged with the
+ * channel number
+ */
+write_event(ev, sp)
+struct event *ev;
+struct sink *sp;
+{
+  struct record r;
+  char line[256], name[32];
+  char *text = (ev->code == VCID)? ev->text: "";
+  char *p = dtran[ev->code];
+  int n;
+
+  PROBE3(event_emit, ev->chan, ev->code, ev->start);
+  if(ev->flags & E_CONFIRM)
+    p = "";
+  if(ev->flags & E_RETRACT)
+    p = "~";
+  n = 0;
+  switch(out_format) {
+    case F_TEXT:
+      if(ev->code == DSIL)
+        n = sprintf(line, "%s", (ev->chan < 0)? "\n": "");
+      else if(!*p)       /* a confirmation, it is out already */
+        break;
+      else if(ev->chan >= 0)
+        n = sprintf(line, "%d:%s%s%s\n", ev->chan, p,
+                    text, *text? " ": "");
+      else
+        n = sprintf(line, "%s%s%s", p, text, *text? " ": "");
+      sink_put(sp, line, n);
+      break;
+    case F_JSON:
+      n = sprintf(line, "{\"chan\":%d,\"code\":%d,\"event\":\"%s\","
+                  "\"start\":%ld,\"end\":%ld,\"peak\":[%.1f,%.1f]",
+                  (ev->chan < 0)? 0: ev->chan, ev->code,
+                  code_name(ev->code, name), ev->start, ev->end,
+                  ev->peak[0], ev->peak[1]);
+      if(*text)
+        n += sprintf(line + n, ",\"text\":\"%s\"", text);
+      if(ev->flags)
+        n += sprintf(line + n, ",\"decision\":\"%s\"",
+                     (ev->flags & E_EARLY)? "early":
+                     (ev->flags & E_CONFIRM)? "confirm": "retract");
+      n += sprintf(line + n, "}\n");
+      sink_put(sp, line, n);
+      break;
+    case F_BIN:
+      r.chan = (ev->chan < 0)? 0: ev->chan;
+      r.code = ev->code | ev->flags << 8;
+      r.start = ev->start;
+      r.end = ev->end;
+      r.peak[0] = ev->peak[0];
+      r.peak[1] = ev->peak[1];
+      sink_put(sp, (char *)&r, sizeof(r));
+      if(ev->code == VCID)
+        sink_put(sp, ev->text, CID_TEXT);
+      break;
+  }
+  sp->events++;
+  if(sp->policy == P_EVENT)
+    sink_flush(sp);
+  return(0);
+}
+
+/*
+ * output the result x of a frame of channel dp
+ */
+emit(dp, x, sp)
+struct detector *dp;
+int x;
+struct sink *sp;
+{
+  struct event ev[MAXEVENTS];
+  int i,n;
+
+  n = frame_events(dp, x, ev);
+  for(i=0; i<n; i++)
+    write_event(&ev[i], sp);
+  return(0);
+}
+
+/* the end of channel dp */
+emit_last(dp, sp)
+struct detector *dp;
+struct sink *sp;
+{
+  struct event ev;
+
+  if(last_event(dp, &ev))
+    write_event(&ev, sp);
+  return(0);
+}
+
+/* -e, see early_part() */
+#define NEARLY       2
+
+int early = 0;                 /* -e */
+int early_at[NEARLY] = { 106, 160 };
+
+/*
+ * read the next frame of channel dp from fd into buf,
+ * in parts, and output an early decision if there is one
+ *
+ * returns 0 at the end of the input
+ */
+read_early(dp, fd, buf, sp)
+struct detector *dp;
+int fd;
+char *buf;
+struct sink *sp;
+{
+  struct partial pa;
+  struct event ev;
+  long at = dp->nframe * N;
+  int i, from = 0, d;
+
+  pa.n = 0;
+  for(i=0; i<NEARLY; i++) {
+    if(!read_part(fd, buf, from, early_at[i]))
       return(0);
-    i += x;
-  } 
-  return(1);
+    from = early_at[i];
+    if(dp->prov < 0 && (d = early_part(dp, &pa, buf, from)) >= 0) {
+      dp->prov = d;
+      set_event(&ev, dp, d, at, at + from);
+      ev.flags = E_EARLY;
+      write_event(&ev, sp);
+    }
+  }
+  return(read_part(fd, buf, from, N));
 }
 
 /*
  * read in frames, output the decoded
  * results
  */
-dtmf_to_ascii(fd1, fd2)
+dtmf_to_ascii(dp, fd1, sp)
+struct detector *dp;
 int fd1;
-FILE *fd2;
+struct sink *sp;
 {
-  int x,last= DSIL;
+  int x;
   char frame[N+5];
-  int silence_time;
-
-  while(read_frame(fd1, frame)) {
-    x = decode(frame); 
+  M_VAR(t);
+  T_VAR(u);
+
+  T_START(u);
+  for(M_START(t); early? read_early(dp, fd1, frame, sp):
+                          read_frame(fd1, frame); M_START(t)) {
+    M_STAGE(S_READ, t);
+    T_SPAN(S_READ, u, 0, 1, 0);
+    PROBE1(frame_read, dp->chan);
+    M_START(t);
+    T_START(u);
+    x = decode(dp, frame); 
+    M_STAGE(S_DECODE, t);
+    T_SPAN(S_DECODE, u, 0, 1, x);
+    M_RESULT(x);
 /*
 if(x== -1) putchar('-');
 if(x==DSIL) putchar(' ');
@@ -436,266 +608,2462 @@ if(x!=DSIL && x!=-1) putchar('a' + x);
 fflush(stdout);
 continue;
 */
+    M_START(t);
+    T_START(u);
+    emit(dp, x, sp);
+    M_STAGE(S_WRITE, t);
+    T_SPAN(S_WRITE, u, 0, 1, 0);
+    sink_tick(sp);
+    METRICS_TICK();
+    T_START(u);
+  }
+  emit_last(dp, sp);
+  if(out_format == F_TEXT)
+    sink_put(sp, "\n", 1);
+}
 
-    if(x >= 0) {
-      if(x == DSIL)
-        silence_time += (silence_time>=0)?1:0 ;
-      else
-        silence_time= 0;
-      if(silence_time == FLUSH_TIME) {
-        fputs("\n",fd2);
-        silence_time= -1;   /* stop counting */
-      }
+/*
+ * capture and replay.
+ *
+ * -R file keeps the frames -m reads, each with the time
+ * it came in, so that a load seen once can be decoded
+ * again the same way.  the capture is a struct cap_head,
+ * then for each frame read a struct cap_rec and its N
+ * samples (none for the record of a channel's end), in
+ * the order they were read.  dt is in microseconds from
+ * the record before.
+ *
+ * -r file decodes a capture instead of inputs, at the
+ * speed of -S: 1 (the default) as it came in, 10 ten
+ * times as fast, 0 as fast as it can be read.  a frame
+ * is let go when its time comes, and how long it then
+ * takes to be decoded is its latency (see lat_add).  the
+ * run's throughput and latencies go to stderr at the end.
+ * each channel is replayed from a list of its own, so a
+ * capture taken with -t replays without it and the other
+ * way round.
+ */
+struct cap_head {
+  char magic[4];          /* DTRC */
+  int version;
+  int n;                  /* samples in a frame */
+  int nchan;
+};
+
+struct cap_rec {
+  unsigned short chan;
+  unsigned short end;     /* the channel is done, no samples */
+  unsigned int dt;
+};
+#define CAP_VERSION  1
+
+struct capture {          /* -R */
+  FILE *fp;
+  long long last;         /* of the record before, ns */
+};
+
+struct cap_frame {
+  char *data;             /* 0 for the end */
+  long long t;            /* ns from the first frame */
+};
+
+struct cap_chan {
+  struct cap_frame *f;
+  long n, next;
+};
+
+struct replay {           /* -r */
+  char *map;
+  int nchan;
+  struct cap_chan *ch;
+  double speed;
+  long long start, end;   /* of the run, ns */
+  long long at;           /* when the last frame was let go */
+  long long span;         /* of the capture */
+  long frames, done;
+};
+
+/* latencies of a replay, a set per worker */
+#define NLAT    24        /* buckets, 1 us and up in powers of 2 */
+#define MAXLAT  64        /* MAXWORKERS */
+
+struct lat {
+  long n, max;
+  double sum;
+  long hist[NLAT];
+  char pad[40];
+};
+
+struct capture *the_capture;   /* -R */
+struct replay *the_replay;     /* -r */
+struct lat lats[MAXLAT];
+
+cap_open(cp, name, nchan)
+struct capture *cp;
+char *name;
+int nchan;
+{
+  struct cap_head h;
 
-      if(x != DSIL && x != last &&
-         (last == DSIL || last==D24 || last == D26 ||
-          last == D2426 || last == DDT || last == DBUSY ||
-          last == DRING) )  { 
-        fputs(dtran[x], fd2);
-#ifndef NOFLUSH
-        fflush(fd2);
-#endif
+  if(nchan > 65535 || !(cp->fp = fopen(name, "w")))
+    return(-1);
+  setvbuf(cp->fp, 0, _IOFBF, 1 << 20);
+  memcpy(h.magic, "DTRC", 4);
+  h.version = CAP_VERSION;
+  h.n = N;
+  h.nchan = nchan;
+  cp->last = 0;
+  return(fwrite(&h, sizeof(h), 1, cp->fp) == 1? 0: -1);
+}
+
+/* frame buf of channel c, or its end if buf is 0 */
+cap_put(cp, c, buf)
+struct capture *cp;
+int c;
+char *buf;
+{
+  struct cap_rec r;
+  long long now = now_ns();
+
+  r.chan = c;
+  r.end = !buf;
+  r.dt = cp->last? (now - cp->last) / 1000: 0;
+  cp->last = now;
+  fwrite(&r, sizeof(r), 1, cp->fp);
+  if(buf)
+    fwrite(buf, N, 1, cp->fp);
+  return(0);
+}
+
+cap_close(cp, name)
+struct capture *cp;
+char *name;
+{
+  if(fclose(cp->fp) == EOF) {
+    perror(name);
+    return(-1);
+  }
+  return(0);
+}
+
+/*
+ * map capture 'name' and sort its frames out by
+ * channel, -1 (and why on stderr) if it can not be
+ * read
+ */
+replay_open(rp, name, speed)
+struct replay *rp;
+char *name;
+double speed;
+{
+  struct cap_head *h;
+  struct cap_rec *r;
+  struct cap_chan *cc;
+  struct stat st;
+  long long t;
+  char *p, *end;
+  int fd, c;
+
+  memset(rp, 0, sizeof(*rp));
+  if((fd = open(name, O_RDONLY)) < 0) {
+    perror(name);
+    return(-1);
+  }
+  if(fstat(fd, &st) < 0) {
+    perror(name);
+    close(fd);
+    return(-1);
+  }
+  if(st.st_size < sizeof(*h) || (rp->map = mmap(0, st.st_size, PROT_READ,
+                                   MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+    fprintf(stderr, "%s: can not map it\n", name);
+    close(fd);
+    return(-1);
+  }
+  close(fd);
+  h = (struct cap_head *)rp->map;
+  if(memcmp(h->magic, "DTRC", 4) || h->version != CAP_VERSION ||
+     h->n != N || h->nchan < 1) {
+    fprintf(stderr, "%s: not a capture of this detector\n", name);
+    munmap(rp->map, st.st_size);
+    rp->map = 0;
+    return(-1);
+  }
+  rp->nchan = h->nchan;
+  rp->speed = speed;
+  if(!(rp->ch = (struct cap_chan *)calloc(rp->nchan, sizeof(*rp->ch)))) {
+    perror("replay");
+    exit(-1);
+  }
+  end = rp->map + st.st_size;
+  for(c=0; c<2; c++) {      /* count them, then list them */
+    for(p=rp->map+sizeof(*h), t=0; p+sizeof(*r) <= end; p += sizeof(*r)) {
+      r = (struct cap_rec *)p;
+      if(r->chan >= rp->nchan || (!r->end && p+sizeof(*r)+N > end))
+        break;               /* cut short */
+      t += r->dt * 1000LL;
+      cc = &rp->ch[r->chan];
+      if(c) {
+        cc->f[cc->n].data = r->end? (char *)0: p + sizeof(*r);
+        cc->f[cc->n].t = t;
+      }
+      cc->n++;
+      if(!r->end) {
+        p += N;
+        rp->frames += c;
       }
-      last = x;
+      rp->span = t;
     }
+    if(!c)
+      for(cc=rp->ch; cc<rp->ch+rp->nchan; cc++) {
+        if(!(cc->f = (struct cap_frame *)malloc((cc->n+1) * sizeof(*cc->f)))) {
+          perror("replay");
+          exit(-1);
+        }
+        cc->n = 0;
+      }
   }
-  fputs("\n",fd2);
+  return(0);
 }
 
-main(argc,argv) 
-int argc;
-char **argv;
+/*
+ * the next frame of channel c into buf, once it is
+ * due.  returns 0 at the channel's end
+ */
+replay_frame(rp, c, buf)
+struct replay *rp;
+int c;
+char *buf;
 {
-  FILE *output;
-  int input;
-
-  input = 0;
-  output = stdout;
-  switch(argc) {
-    case 1:  break;
-    case 3:  output = fopen(argv[2],"w");
-             if(!output) {
-               perror(argv[2]);
-               return(-1);
-             }
-             /* fall through */
-    case 2:  input = open(argv[1],0);
-             if(input < 0) {
-               perror(argv[1]);
-               return(-1);
-             }
-             break;
-     default:
-        fprintf(stderr,"usage:  %s [input [output]]\n",argv[0]);
-        return(-1);
+  struct cap_chan *cc = &rp->ch[c];
+  struct cap_frame *f;
+  struct timespec ts;
+  long long due;
+
+  if(!rp->start)
+    rp->start = now_ns();
+  if(cc->next >= cc->n || !(f = &cc->f[cc->next++])->data)
+    return(0);
+  if(rp->speed > 0) {
+    due = rp->start + (long long)(f->t / rp->speed);
+    ts.tv_sec = due / 1000000000LL;
+    ts.tv_nsec = due % 1000000000LL;
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == EINTR)
+      ;
+  }
+  memcpy(buf, f->data, N);
+  rp->done++;
+  rp->at = now_ns();
+  return(1);
+}
+
+/* a frame let go at 'at' is decoded */
+lat_add(lp, at)
+struct lat *lp;
+long long at;
+{
+  long us = (now_ns() - at) / 1000;
+  int b;
+
+  for(b=0; b<NLAT-1 && us >= (1L << b); b++)
+    ;
+  lp->hist[b]++;
+  lp->n++;
+  lp->sum += us;
+  if(us > lp->max)
+    lp->max = us;
+  return(0);
+}
+
+/* the run's throughput and latencies, on stderr */
+replay_report(rp)
+struct replay *rp;
+{
+  static double ps[] = { 0.5, 0.9, 0.99, 0.999 };
+  struct lat all;
+  double secs;
+  long sum;
+  int b,i,w;
+
+  rp->end = now_ns();
+  secs = (rp->end - rp->start) / 1e9;
+  memset(&all, 0, sizeof(all));
+  for(w=0; w<MAXLAT; w++) {
+    all.n += lats[w].n;
+    all.sum += lats[w].sum;
+    if(lats[w].max > all.max)
+      all.max = lats[w].max;
+    for(b=0; b<NLAT; b++)
+      all.hist[b] += lats[w].hist[b];
+  }
+  fprintf(stderr, "replay: %d channels, %ld frames, %.3f s of capture "
+          "in %.3f s, %.1fx, %.0f frames/s\n", rp->nchan, rp->done,
+          rp->span / 1e9, secs, secs > 0? rp->span / 1e9 / secs: 0.0,
+          secs > 0? rp->done / secs: 0.0);
+  if(!all.n)
+    return(0);
+  fprintf(stderr, "latency: %ld batches, mean %.1f us, max %ld us",
+          all.n, all.sum / all.n, all.max);
+  for(i=0; i<sizeof(ps)/sizeof(ps[0]); i++) {
+    for(b=0, sum=0; b<NLAT-1 && (sum += all.hist[b]) < ps[i] * all.n; b++)
+      ;
+    fprintf(stderr, ", p%g < %ld us", ps[i] * 100, 1L << b);
   }
-  dtmf_to_ascii(input,output);
-  fputs("Done.\n",output);
+  fputc('\n', stderr);
   return(0);
 }
 
-#if 0
 /*
-<-->
-<++> dtmf/gen.c
-*/
+ * the next frame of channel c into buf, read from fd or
+ * the replay, and kept if there is a capture
+ *
+ * returns 0 at the end of the channel
+ */
+in_frame(c, fd, buf)
+int c, fd;
+char *buf;
+{
+  int ok;
+
+  if(the_replay)
+    ok = replay_frame(the_replay, c, buf);
+  else
+    ok = read_frame(fd, buf);
+  PROBE1(frame_read, c);
+  if(the_capture)
+    cap_put(the_capture, c, ok? buf: (char *)0);
+  return(ok);
+}
 
-/* -------- local defines (if we had more.. seperate file) ----- */
-#define FSAMPLE   8000   /* sampling rate, 8KHz */
+/*
+ * the same for nchan inputs at once, fds[c] is
+ * channel c.  the channels go through the
+ * detector batch_lanes at a time, as a batch.
+ */
+multi_to_ascii(dp, fds, nchan, sp)
+struct detector *dp;
+int *fds, nchan;
+struct sink *sp;
+{
+  struct batch b;
+  int x[NCHAN],c,g,live;
+  char frame[N+5];
+  M_VAR(t);
+  T_VAR(u);
+
+  do {
+    for(g=0, live=0; g<nchan; g+=batch_lanes) {
+      b.nchan = (nchan-g < batch_lanes)? nchan-g: batch_lanes;
+      M_START(t);
+      T_START(u);
+      for(c=0; c<b.nchan; c++) {
+        if(fds[g+c] >= 0 && !in_frame(g+c, fds[g+c], frame))
+          fds[g+c] = -1;        /* this one is done */
+        if(fds[g+c] >= 0) {
+          batch_ingest(&b, c, frame);
+          live++;
+        } else
+          batch_ingest(&b, c, (char *)0);
+      }
+      M_STAGE(S_READ, t);
+      T_SPAN(S_READ, u, g, b.nchan, 0);
+      M_START(t);
+      T_START(u);
+      batch_decode(&b, dp+g, x);
+      M_STAGE(S_DECODE, t);
+      T_SPAN(S_DECODE, u, g, b.nchan, x[0]);
+      M_START(t);
+      T_START(u);
+      for(c=0; c<b.nchan; c++)
+        if(fds[g+c] >= 0) {
+          M_RESULT(x[c]);
+          emit(&dp[g+c], x[c], sp);
+        } else
+          emit_last(&dp[g+c], sp);
+      M_STAGE(S_WRITE, t);
+      T_SPAN(S_WRITE, u, g, b.nchan, 0);
+      if(the_replay)
+        lat_add(&lats[0], the_replay->at);
+    }
+    sink_tick(sp);
+    METRICS_TICK();
+  } while(live);
+}
 
 /*
- * FLOAT_TO_SAMPLE converts a float in the range -1.0 to 1.0 
- * into a format valid to be written out in a sound file
- * or to a sound device 
+ * WAV input.
+ *
+ * a .wav holds its channels interleaved, a call recording
+ * has a leg in each.  the channels are decoded as the
+ * lanes of one batch, so every leg has a detector of its
+ * own and its events carry the leg's channel number (0
+ * is the first, left one).  8 bit (unsigned) and 16 bit
+ * PCM, up to NCHAN channels, at FSAMPLE or resampled
+ * to it (see rs_init).
+ *
+ * a frame of all the channels is read in one piece and
+ * converted to float, 8 or 16 samples at a time with
+ * SSE2.  the batch is sample major, the same as the file,
+ * so the samples only have to be spread out to the lanes.
  */
-#ifdef SIGNED
-#  define FLOAT_TO_SAMPLE(x)    ((char)((x) * 127.0))
-#else
-#  define FLOAT_TO_SAMPLE(x)    ((char)((x + 1.0) * 127.0))
-#endif
+#define RS_MAXRATE  96000      /* the highest rate resampled */
 
-#define SOUND_DEV  "/dev/dsp"
-typedef char sample;
-/* --------------------------------------------------------------- */
+struct wav {
+  int nchan;
+  int bits;              /* 8 or 16 */
+  long rate;
+  long left;             /* bytes of samples still to come */
+  struct resamp *rs;     /* to FSAMPLE, or 0 */
+};
 
-#include <fcntl.h>
+struct resamp *rs_init();
+
+/* little endian numbers in the header */
+#define LE16(p)  ((p)[0] | (p)[1] << 8)
+#define LE32(p)  (LE16(p) | (long)LE16((p)+2) << 16)
 
 /*
- * take the sine of x, where x is 0 to 65535 (for 0 to 360 degrees)
+ * if fd is a .wav, read its header up to the samples
+ *
+ * returns 1 for a .wav, 0 if it is not one (fd is back
+ * at the start, a pipe is taken as raw samples) and -1
+ * for one that cannot be decoded
  */
-float mysine(in)
-short in;
+wav_open(fd, wp)
+int fd;
+struct wav *wp;
 {
-  static coef[] = {
-     3.140625, 0.02026367, -5.325196, 0.5446778, 1.800293 };
-  float x,y,res;
-  int sign,i;
- 
-  if(in < 0) {       /* force positive */
-    sign = -1;
-    in = -in;
-  } else
-    sign = 1;
-  if(in >= 0x4000)      /* 90 degrees */
-    in = 0x8000 - in;   /* 180 degrees - in */
-  x = in * (1/32768.0); 
-  y = x;               /* y holds x^i) */
-  res = 0;
-  for(i=0; i<5; i++) {
-    res += y * coef[i];
-    y *= x;
+  unsigned char h[40];
+  long len;
+  int tag;
+
+  if(lseek(fd, 0L, SEEK_CUR) != 0)
+    return(0);
+  if(!read_part(fd, h, 0, 12) || memcmp(h, "RIFF", 4) ||
+     memcmp(h+8, "WAVE", 4)) {
+    lseek(fd, 0L, SEEK_SET);
+    return(0);
+  }
+  tag = 0;
+  for(;;) {              /* the chunks, up to the data */
+    if(!read_part(fd, h, 0, 8))
+      break;
+    len = LE32(h+4);
+    if(!memcmp(h, "data", 4))
+      break;
+    if(memcmp(h, "fmt ", 4)) {
+      lseek(fd, len + (len & 1), SEEK_CUR);
+      continue;
+    }
+    if(len < 16 || len > sizeof(h) || !read_part(fd, h, 0, len + (len & 1)))
+      break;
+    tag = LE16(h);
+    if(tag == 0xfffe && len >= 26)    /* extensible, the sub format */
+      tag = LE16(h+24);
+    wp->nchan = LE16(h+2);
+    wp->rate = LE32(h+4);
+    wp->bits = LE16(h+14);
+  }
+  if(memcmp(h, "data", 4) || tag != 1 ||
+     (wp->bits != 8 && wp->bits != 16) ||
+     wp->nchan < 1 || wp->nchan > NCHAN ||
+     (wp->rs = rs_init(wp->rate)) == (struct resamp *)-1) {
+    fprintf(stderr, "only 8 or 16 bit PCM .wav, %d to %d Hz, "
+            "up to %d channels\n", FSAMPLE, RS_MAXRATE, NCHAN);
+    return(-1);
   }
-  return(res * sign); 
+  /* a .wav written as a stream may not know its length */
+  wp->left = (len == 0 || len == 0xffffffffL)? 0x7fffffffL: len;
+  return(1);
 }
 
 /*
- * play tone1 and tone2 (in Hz)
- * for 'length' milliseconds
- * outputs samples to sound_out
+ * n samples of 'bits' bits in raw to floats in f
  */
-two_tones(sound_out,tone1,tone2,length)
-int sound_out;
-unsigned int tone1,tone2,length;
+wav_float(raw, f, n, bits)
+unsigned char *raw;
+float *f;
+int n, bits;
 {
-#define BLEN 128
-  sample cout[BLEN];
-  float out;
-  unsigned int ad1,ad2;
-  short c1,c2;
-  int i,l,x;
-   
-  ad1 = (tone1 << 16) / FSAMPLE;
-  ad2 = (tone2 << 16) / FSAMPLE;
-  l = (length * FSAMPLE) / 1000;
-  x = 0;
-  for( c1=0, c2=0, i=0 ;
-       i < l;
-       i++, c1+= ad1, c2+= ad2 ) {
-    out = (mysine(c1) + mysine(c2)) * 0.5;
-    cout[x++] = FLOAT_TO_SAMPLE(out);
-    if (x==BLEN) {
-      write(sound_out, cout, x * sizeof(sample));
-      x=0;
+  int i = 0;
+#ifdef __SSE2__
+  __m128i v, lo, hi, z = _mm_setzero_si128();
+  __m128 s16 = _mm_set1_ps(1/32768.0);
+
+  if(bits == 16)
+    for(; i+8 <= n; i += 8) {
+      v = _mm_loadu_si128((__m128i *)(raw + 2*i));
+      lo = _mm_srai_epi32(_mm_unpacklo_epi16(z, v), 16);
+      hi = _mm_srai_epi32(_mm_unpackhi_epi16(z, v), 16);
+      _mm_storeu_ps(f+i, _mm_mul_ps(_mm_cvtepi32_ps(lo), s16));
+      _mm_storeu_ps(f+i+4, _mm_mul_ps(_mm_cvtepi32_ps(hi), s16));
     }
-  }
-  write(sound_out, cout, x);
+  else         /* unsigned 8 bit, less 128 and as 16 bit */
+    for(; i+16 <= n; i += 16) {
+      v = _mm_xor_si128(_mm_loadu_si128((__m128i *)(raw + i)),
+                        _mm_set1_epi8(0x80));
+      lo = _mm_unpacklo_epi8(z, v);
+      hi = _mm_unpackhi_epi8(z, v);
+      _mm_storeu_ps(f+i, _mm_mul_ps(_mm_cvtepi32_ps(
+                    _mm_srai_epi32(_mm_unpacklo_epi16(z, lo), 16)), s16));
+      _mm_storeu_ps(f+i+4, _mm_mul_ps(_mm_cvtepi32_ps(
+                    _mm_srai_epi32(_mm_unpackhi_epi16(z, lo), 16)), s16));
+      _mm_storeu_ps(f+i+8, _mm_mul_ps(_mm_cvtepi32_ps(
+                    _mm_srai_epi32(_mm_unpacklo_epi16(z, hi), 16)), s16));
+      _mm_storeu_ps(f+i+12, _mm_mul_ps(_mm_cvtepi32_ps(
+                    _mm_srai_epi32(_mm_unpackhi_epi16(z, hi), 16)), s16));
+    }
+#endif
+  for(; i<n; i++)
+    f[i] = (bits == 16)? (short)LE16(raw + 2*i) / 32768.0:
+                         ((int)raw[i] - 128) / 128.0;
+  return(0);
 }
 
 /*
- * silence on 'sound_out'
- * for length milliseconds
+ * resampling to FSAMPLE.
+ *
+ * a .wav at 16, 44.1 or 48 kHz, or any rate where
+ * FSAMPLE/rate is L/M with L up to RS_MAXL, goes through
+ * a polyphase FIR: up by L, low pass, keep every M'th.
+ * the filter is a kaiser windowed sinc designed at L
+ * times the rate, flat to 3.4 kHz and 60 dB down from
+ * 4.6 kHz, where it would alias back onto 3.4 kHz.  an
+ * output only needs one of the L phases, ntaps taps at
+ * the input rate, done 4 at a time with SSE.
+ *
+ * the file's samples are converted straight into the
+ * filter's history and the filter's output is the batch
+ * the resonators run on, there is no 8 kHz copy.
+ *
+ * the filter is symmetric, so every tone comes out a
+ * fixed (L*ntaps-1)/2M samples late (1.5 ms at 48 kHz).
+ * that is the detectors' delay, taken off event times.
  */
-silence(sound_out,length)
-int sound_out;
-unsigned int length;
+#define RS_PASS     3400.0
+#define RS_STOP     4600.0
+#define RS_ATTEN    60.0       /* dB */
+#define RS_MAXL     320        /* 11025 Hz is 320/441 */
+#define RS_MAXIN    (N * RS_MAXRATE / FSAMPLE + 1)  /* input for a frame */
+#define RS_HIST     (2 * RS_MAXIN)
+
+struct resamp {
+  int L, M;
+  int ntaps;             /* per phase, a multiple of 4 */
+  float *taps;           /* [L][ntaps], each phase back to front */
+  long t;                /* next output at t/L of hist, phase t%L */
+  int have;              /* samples in hist */
+  int delay;             /* in samples at FSAMPLE */
+  float hist[NCHAN][RS_HIST];
+  float f[RS_MAXIN * NCHAN];   /* a read, as floats */
+  unsigned char raw[RS_MAXIN * NCHAN * 2];
+};
+
+/* the zeroth order bessel function, for the window */
+double bessel0(x)
+double x;
 {
-  int l,i,x;
-  static sample c0 = FLOAT_TO_SAMPLE(0.0);
-  sample cout[BLEN];
+  double s = 1.0, t = 1.0;
+  int k;
 
-  x = 0;
-  l = (length * FSAMPLE) / 1000;
-  for(i=0; i < l; i++) {
-    cout[x++] = c0;
-    if (x==BLEN) {
-      write(sound_out, cout, x * sizeof(sample));
-      x=0;
-    }
+  for(k=1; t > 1e-10 * s; k++) {
+    t *= (x / (2*k)) * (x / (2*k));
+    s += t;
   }
-  write(sound_out, cout, x);
+  return(s);
 }
 
 /*
- * play a single dtmf tone
- * for a length of time,
- * input is 0-9 for digit, 10 for * 11 for #
+ * a resampler from 'rate' to FSAMPLE
+ *
+ * returns 0 if none is needed, -1 if it cannot be done
  */
-dtmf(sound_fd, digit, length)
-int sound_fd;
-int digit, length;
+struct resamp *rs_init(rate)
+long rate;
 {
-  /* Freqs for 0-9, *, # */
-  static int row[] = {
-    941, 697, 697, 697, 770, 770, 770, 852, 852, 852, 941, 941 };
-  static int col[] = {
-    1336, 1209, 1336, 1477, 1209, 1336, 1477, 1209, 1336, 1447,
-    1209, 1477 };
-
-  two_tones(sound_fd, row[digit], col[digit], length);
+  struct resamp *rp;
+  double fc, beta, m, x, w;
+  long a, b, c;
+  int L, M, K, np, i, p;
+
+  if(rate == FSAMPLE)
+    return((struct resamp *)0);
+  for(a=FSAMPLE, b=rate; b; c=a%b, a=b, b=c)   /* gcd */
+    ;
+  L = FSAMPLE / a;
+  M = rate / a;
+  if(rate < FSAMPLE || rate > RS_MAXRATE || L > RS_MAXL)
+    return((struct resamp *)-1);
+  rp = (struct resamp *)calloc(1, sizeof(*rp));
+  /* kaiser's length and beta for the transition band */
+  K = (RS_ATTEN - 8) / (2.285 * 2*M_PI * (RS_STOP - RS_PASS) / rate) + 1;
+  K = (K + 3) & ~3;
+  np = K * L;
+  rp->taps = (float *)malloc(np * sizeof(float));
+  beta = 0.1102 * (RS_ATTEN - 8.7);
+  fc = (RS_PASS + RS_STOP) / 2 / ((double)rate * L);  /* cycles a tap */
+  m = (np - 1) / 2.0;
+  for(i=0; i<np; i++) {
+    x = i - m;
+    w = bessel0(beta * sqrt(1.0 - (x/m) * (x/m))) / bessel0(beta);
+    p = i % L;           /* tap i is tap i/L of phase i%L */
+    rp->taps[p*K + K-1 - i/L] = L * 2*fc * w *
+                                ((x == 0)? 1.0: sin(2*M_PI*fc*x) / (2*M_PI*fc*x));
+  }
+  rp->L = L;
+  rp->M = M;
+  rp->ntaps = K;
+  rp->have = K - 1;      /* the history before the first sample is 0 */
+  rp->t = (long)(K - 1) * L;
+  rp->delay = (np - 1) / (2.0 * M) + 0.5;
+  return(rp);
 }
 
 /*
- * take a string and output as dtmf
- * valid characters, 0-9, *, #
- * all others play as 50ms silence 
+ * the next frame of the .wav wp, from fd into the batch,
+ * resampled.  returns 0 at the end of the samples
  */
-dial(sound_fd, number)
-int sound_fd;
-char *number;
+rs_frame(fd, wp, bp)
+int fd;
+struct wav *wp;
+struct batch *bp;
 {
-  int i,x;
-  char c;
+  struct resamp *rp = wp->rs;
+  float *g, *h, y, e[NCHAN];
+  int K = rp->ntaps, i, j, c, n, need, size;
+#ifdef __SSE__
+  __m128 acc;
+  float v[4];
+#endif
+
+  /* the newest sample the last output of the frame needs */
+  need = (rp->t + (long)(N-1) * rp->M) / rp->L + 1 - rp->have;
+  size = need * wp->nchan * wp->bits/8;
+  if(need > 0) {
+    if(wp->left < size || !read_part(fd, rp->raw, 0, size))
+      return(0);
+    wp->left -= size;
+    wav_float(rp->raw, rp->f, need * wp->nchan, wp->bits);
+    for(j=0; j<need; j++)
+      for(c=0; c<wp->nchan; c++)
+        rp->hist[c][rp->have + j] = rp->f[j * wp->nchan + c];
+    rp->have += need;
+  }
 
-  for(i=0;number[i];i++) {
-     c = number[i];
-     x = -1;
-     if(c >= '0' && c <= '9')
-       x = c - '0';
-     else if(c == '*')
-       x = 10;
-     else if(c == '#')
-       x = 11;
-     if(x >= 0)
-       dtmf(sound_fd, x, 50);
-     silence(sound_fd,50);
+  for(c=0; c<wp->nchan; c++)
+    e[c] = 0.0;
+  for(i=0; i<N; i++, rp->t += rp->M) {
+    n = rp->t / rp->L - (K-1);       /* the oldest sample it needs */
+    g = rp->taps + (rp->t % rp->L) * K;
+    for(c=0; c<wp->nchan; c++) {
+      h = rp->hist[c] + n;
+#ifdef __SSE__
+      acc = _mm_setzero_ps();
+      for(j=0; j<K; j+=4)
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(g+j),
+                                         _mm_loadu_ps(h+j)));
+      _mm_storeu_ps(v, acc);
+      y = v[0] + v[1] + v[2] + v[3];
+#else
+      for(j=0, y=0.0; j<K; j++)
+        y += g[j] * h[j];
+#endif
+      bp->x[i][c] = y;
+      e[c] += y * y;
+    }
+    if(i == PRE_N-1)
+      for(c=0; c<wp->nchan; c++)
+        bp->pre[c] = e[c];
   }
+  for(c=0; c<wp->nchan; c++)
+    bp->energy[c] = e[c];
+  bp->nchan = wp->nchan;
+
+  /* drop the history the next frame does not need */
+  n = rp->t / rp->L - (K-1);
+  for(c=0; c<wp->nchan; c++)
+    memmove(rp->hist[c], rp->hist[c] + n, (rp->have - n) * sizeof(float));
+  rp->have -= n;
+  rp->t -= (long)n * rp->L;
+  return(1);
 }
 
-main()
+/*
+ * the next frame of every channel of wp, from fd
+ * into the batch
+ *
+ * returns 0 at the end of the samples
+ */
+wav_frame(fd, wp, bp)
+int fd;
+struct wav *wp;
+struct batch *bp;
 {
-  int sfd;
-  char number[100];
-
-  sfd = open(SOUND_DEV,O_RDWR);
-  if(sfd<0) {
-    perror(SOUND_DEV);
-    return(-1);
+  unsigned char raw[N*NCHAN*2];
+  float f[N*NCHAN], e[NCHAN], in;
+  int n = N * wp->nchan, size = n * wp->bits/8;
+  int i,c;
+
+  if(wp->rs)
+    return(rs_frame(fd, wp, bp));
+  if(wp->left < size || !read_part(fd, raw, 0, size))
+    return(0);
+  wp->left -= size;
+  wav_float(raw, f, n, wp->bits);
+  for(c=0; c<wp->nchan; c++)
+    e[c] = 0.0;
+  for(i=0; i<N; i++) {
+    for(c=0; c<wp->nchan; c++) {
+      in = f[i * wp->nchan + c];
+      bp->x[i][c] = in;
+      e[c] += in * in;
+    }
+    if(i == PRE_N-1)
+      for(c=0; c<wp->nchan; c++)
+        bp->pre[c] = e[c];
   }
-  printf("Enter fone number: ");
-  gets(number);
-  dial(sfd,number);
+  for(c=0; c<wp->nchan; c++)
+    bp->energy[c] = e[c];
+  bp->nchan = wp->nchan;
+  PROBE1(frame_read, 0);
+  return(1);
 }
 
 /*
-<-->
-<++> dtmf/Makefile
-*/
+ * decode the channels of the .wav on fd, dp[c]
+ * is channel c
+ */
+wav_to_ascii(dp, fd, wp, sp)
+struct detector *dp;
+int fd;
+struct wav *wp;
+struct sink *sp;
+{
+  struct batch b;
+  int x[NCHAN],c;
+  M_VAR(t);
+  T_VAR(u);
+
+  memset(&b, 0, sizeof(b));     /* the lanes not in use stay 0 */
+  T_START(u);
+  for(M_START(t); wav_frame(fd, wp, &b); M_START(t)) {
+    M_STAGE(S_READ, t);
+    T_SPAN(S_READ, u, 0, wp->nchan, 0);
+    M_START(t);
+    T_START(u);
+    batch_decode(&b, dp, x);
+    M_STAGE(S_DECODE, t);
+    T_SPAN(S_DECODE, u, 0, wp->nchan, x[0]);
+    M_START(t);
+    T_START(u);
+    for(c=0; c<wp->nchan; c++) {
+      M_RESULT(x[c]);
+      emit(&dp[c], x[c], sp);
+    }
+    M_STAGE(S_WRITE, t);
+    T_SPAN(S_WRITE, u, 0, wp->nchan, 0);
+    sink_tick(sp);
+    METRICS_TICK();
+    T_START(u);
+  }
+  for(c=0; c<wp->nchan; c++)
+    emit_last(&dp[c], sp);
+  if(out_format == F_TEXT && wp->nchan == 1)
+    sink_put(sp, "\n", 1);
+  return(0);
+}
 
+#ifdef THREADS
 /*
-#
-# Defines:
-#  UNSIGNED  -  use unsigned 8 bit samples
-#               otherwise use signed 8 bit samples
-#
-
-CFLAGS= -DUNSIGNED
-
-default:	detect gen
-
-detect: detect.c
-	$(CC) detect.c -o detect
+ * the pipeline, compiled in with -DTHREADS (and -lpthread)
+ *
+ *   capture  ->  detection workers  ->  sink
+ *
+ * capture reads a frame of every input and hands each
+ * batch of channels to the worker owning it, a
+ * worker decodes and turns its results into events, the
+ * sink writes them out.  the stages are joined by single
+ * producer, single consumer rings (one pair per worker)
+ * so no locks are taken.  a channel always goes to the
+ * same worker, its events stay in order.
+ *
+ * a full frame ring holds capture back (there is nothing
+ * better to do with input that can not be decoded yet).
+ * a full event ring never holds a worker back, the event
+ * is dropped and counted, so a slow output can not delay
+ * the audio; the count goes to stderr at the end and the
+ * run fails.  (a scan into an index waits instead, see
+ * scan_worker.)  a stage with nothing to do yields a
+ * few times, then sleeps (see ring_idle).
+ */
+#define FRAME_SLOTS  64       /* per worker, a power of 2 */
+#define EVENT_SLOTS  4096     /* per worker, a power of 2 */
+#define MAXWORKERS   64
+
+/*
+ * a single producer, single consumer ring of 'size'
+ * slots of 'esize' bytes.  the producer fills the slot
+ * ring_wslot() gives it and publishes it with
+ * ring_push(), the consumer reads ring_rslot() and
+ * frees it with ring_pop().  head is only written
+ * by the producer and tail by the consumer, on lines
+ * of their own.
+ */
+struct ring {
+  unsigned head;          /* next slot to fill */
+  char pad1[60];
+  unsigned tail;          /* next slot to read */
+  char pad2[60];
+  unsigned size, esize;
+  char *buf;
+  int done;               /* the producer has finished */
+  unsigned maxdepth;
+};
+
+ring_init(rp,size,esize)
+struct ring *rp;
+unsigned size, esize;
+{
+  memset(rp, 0, sizeof(*rp));
+  rp->size = size;
+  rp->esize = esize;
+  rp->buf = malloc(size * esize);
+  return(rp->buf != 0);
+}
+
+/* the next free slot, 0 if the ring is full */
+char *ring_wslot(rp)
+struct ring *rp;
+{
+  unsigned tail = __atomic_load_n(&rp->tail, __ATOMIC_ACQUIRE);
+
+  if(rp->head - tail == rp->size)
+    return(0);
+  return(rp->buf + (rp->head & (rp->size-1)) * rp->esize);
+}
+
+ring_push(rp)
+struct ring *rp;
+{
+  unsigned depth = rp->head + 1 - __atomic_load_n(&rp->tail, __ATOMIC_RELAXED);
 
-gen:	gen.c
-	$(CC) gen.c -o gen
+  if(depth > rp->maxdepth)
+    rp->maxdepth = depth;
+  __atomic_store_n(&rp->head, rp->head + 1, __ATOMIC_RELEASE);
+  return(0);
+}
 
-clobber: clean
-	rm -rf detect gen 
+/* the oldest full slot, 0 if the ring is empty */
+char *ring_rslot(rp)
+struct ring *rp;
+{
+  unsigned head = __atomic_load_n(&rp->head, __ATOMIC_ACQUIRE);
 
-clean:
-	rm -rf *.o core a.out
-<-->
+  if(head == rp->tail)
+    return(0);
+  return(rp->buf + (rp->tail & (rp->size-1)) * rp->esize);
+}
 
-EOF
-*/
+ring_pop(rp)
+struct ring *rp;
+{
+  __atomic_store_n(&rp->tail, rp->tail + 1, __ATOMIC_RELEASE);
+  return(0);
+}
+
+ring_finish(rp)
+struct ring *rp;
+{
+  __atomic_store_n(&rp->done, 1, __ATOMIC_RELEASE);
+  return(0);
+}
+
+/* empty, and nothing more will come */
+ring_drained(rp)
+struct ring *rp;
+{
+  return(__atomic_load_n(&rp->done, __ATOMIC_ACQUIRE) && !ring_rslot(rp));
+}
+
+/*
+ * wait for a ring, the *np'th time running that it was
+ * found empty (or full), 0 it again on progress.  a few
+ * yields, then sleeps doubling up to IDLE_MAX_US, so an
+ * idle pipeline does not keep its cores busy
+ */
+#define IDLE_SPINS   64
+#define IDLE_MAX_US  1024
+
+ring_idle(np)
+int *np;
+{
+  struct timespec ts;
+  int n = ++*np - IDLE_SPINS;
+
+  if(n <= 0)
+    return(sched_yield());
+  ts.tv_sec = 0;
+  ts.tv_nsec = ((n < 7)? 16L << n: IDLE_MAX_US) * 1000L;
+  nanosleep(&ts, 0);
+  return(0);
+}
+
+/* a frame of one batch, capture to worker */
+struct work {
+  int g;                  /* first channel of the batch */
+  int nchan;
+  char live[NCHAN];
+  long long at;           /* let go by the replay, or 0 */
+  char data[NCHAN][N];
+};
+
+struct pipeline {
+  struct detector *dp;
+  int *fds, nchan, nworkers;
+  struct sink *out;
+  struct ring frames[MAXWORKERS];
+  struct ring events[MAXWORKERS];
+  long stalls;            /* capture waits on a full frame ring */
+  long dropped;           /* events lost to a full event ring */
+};
+
+struct worker {
+  struct pipeline *pl;
+  int w;
+};
+
+struct pipeline *the_pipeline;   /* the one running, for metrics */
+struct ix *the_index;            /* the scan's events go here, see ix_add */
+
+
+/* the events lost to full rings, on stderr.  1 if any */
+ring_lost(pl)
+struct pipeline *pl;
+{
+  if(!pl->dropped)
+    return(0);
+  fprintf(stderr, "events dropped %ld\n", pl->dropped);
+  return(1);
+}
+
+/*
+ * detection worker, decodes the batches
+ * of ring frames[w] into events[w]
+ */
+void *detect_worker(arg)
+void *arg;
+{
+  struct worker *wp = (struct worker *)arg;
+  struct pipeline *pl = wp->pl;
+  struct ring *in = &pl->frames[wp->w], *out = &pl->events[wp->w];
+  struct batch b;
+  struct work *wk;
+  struct event *ev, e[MAXEVENTS];
+  int x[NCHAN],c,i,n,idle = 0;
+  M_VAR(t);
+  T_VAR(u);
+
+  for(;;) {
+    if(!(wk = (struct work *)ring_rslot(in))) {
+      if(ring_drained(in))
+        break;
+      ring_idle(&idle);
+      continue;
+    }
+    idle = 0;
+    M_START(t);
+    T_START(u);
+    b.nchan = wk->nchan;
+    for(c=0; c<wk->nchan; c++)
+      batch_ingest(&b, c, wk->live[c]? wk->data[c]: (char *)0);
+    batch_decode(&b, pl->dp + wk->g, x);
+    M_STAGE(S_DECODE, t);
+    T_SPAN(S_DECODE, u, wk->g, wk->nchan, x[0]);
+    for(c=0; c<wk->nchan; c++) {
+      if(wk->live[c]) {
+        M_RESULT(x[c]);
+        n = frame_events(&pl->dp[wk->g+c], x[c], e);
+      } else
+        n = last_event(&pl->dp[wk->g+c], e);
+      for(i=0; i<n; i++) {
+        if(!(ev = (struct event *)ring_wslot(out))) {
+          __sync_fetch_and_add(&pl->dropped, 1);
+          continue;
+        }
+        *ev = e[i];
+        ring_push(out);
+      }
+    }
+    if(wk->at)
+      lat_add(&lats[wp->w], wk->at);
+    ring_pop(in);
+  }
+  ring_finish(out);
+  return(0);
+}
+
+/* the sink, writes the events of every worker */
+void *event_sink(arg)
+void *arg;
+{
+  struct pipeline *pl = (struct pipeline *)arg;
+  struct event *ev;
+  int w,busy,done,idle = 0;
+  M_VAR(t);
+  T_VAR(u);
+
+  do {
+    for(w=0, busy=0, done=0; w<pl->nworkers; w++) {
+      while((ev = (struct event *)ring_rslot(&pl->events[w]))) {
+        M_START(t);
+        T_START(u);
+        if(the_index)
+          ix_add(the_index, ev);
+        else
+          write_event(ev, pl->out);
+        M_STAGE(S_WRITE, t);
+        T_SPAN(S_WRITE, u, ev->chan, 1, 0);
+        ring_pop(&pl->events[w]);
+        busy++;
+      }
+      done += ring_drained(&pl->events[w]);
+    }
+    METRICS_TICK();
+    sink_tick(pl->out);
+    if(busy)
+      idle = 0;
+    else
+      ring_idle(&idle);
+  } while(done < pl->nworkers);
+  return(0);
+}
+
+/*
+ * multi_to_ascii() as a pipeline, capture runs on
+ * the calling thread.  returns 1 if events were
+ * dropped, -1 if the threads
+ * can not be had.
+ */
+pipe_to_ascii(dp, fds, nchan, sp, nworkers)
+struct detector *dp;
+int *fds, nchan;
+struct sink *sp;
+int nworkers;
+{
+  static struct pipeline pl;
+  struct worker wk[MAXWORKERS];
+  pthread_t tid[MAXWORKERS], sink;
+  struct work *wp;
+  int c,g,w,live,ngroups,idle;
+  M_VAR(t);
+  T_VAR(u);
+
+  ngroups = (nchan + batch_lanes-1) / batch_lanes;
+  if(nworkers > ngroups)       /* one batch is one worker's at most */
+    nworkers = ngroups;
+  if(nworkers > MAXWORKERS)
+    nworkers = MAXWORKERS;
+  pl.dp = dp;
+  pl.fds = fds;
+  pl.nchan = nchan;
+  pl.nworkers = nworkers;
+  pl.out = sp;
+  the_pipeline = &pl;
+  for(w=0; w<nworkers; w++) {
+    if(!ring_init(&pl.frames[w], FRAME_SLOTS, sizeof(struct work)) ||
+       !ring_init(&pl.events[w], EVENT_SLOTS, sizeof(struct event)))
+      return(-1);
+    wk[w].pl = &pl;
+    wk[w].w = w;
+    if(pthread_create(&tid[w], 0, detect_worker, &wk[w]))
+      return(-1);
+  }
+  if(pthread_create(&sink, 0, event_sink, &pl))
+    return(-1);
+
+  do {
+    for(g=0, live=0; g<nchan; g+=batch_lanes) {
+      w = (g / batch_lanes) % nworkers;
+      if(!(wp = (struct work *)ring_wslot(&pl.frames[w]))) {
+        pl.stalls++;
+        for(idle=0; !(wp = (struct work *)ring_wslot(&pl.frames[w])); )
+          ring_idle(&idle);
+      }
+      M_START(t);
+      T_START(u);
+      wp->g = g;
+      wp->nchan = (nchan-g < batch_lanes)? nchan-g: batch_lanes;
+      for(c=0; c<wp->nchan; c++) {
+        if(fds[g+c] >= 0 && !in_frame(g+c, fds[g+c], wp->data[c]))
+          fds[g+c] = -1;
+        wp->live[c] = fds[g+c] >= 0;
+        live += wp->live[c];
+      }
+      wp->at = the_replay? the_replay->at: 0;
+      ring_push(&pl.frames[w]);
+      M_STAGE(S_READ, t);
+      T_SPAN(S_READ, u, g, wp->nchan, 0);
+    }
+  } while(live);
+
+  for(w=0; w<nworkers; w++)
+    ring_finish(&pl.frames[w]);
+  for(w=0; w<nworkers; w++)
+    pthread_join(tid[w], 0);
+  pthread_join(sink, 0);
+  the_pipeline = 0;
+#ifdef STATS
+  for(w=0; w<nworkers; w++)
+    fprintf(stderr,"worker %d  frame ring max %u  event ring max %u\n",
+            w, pl.frames[w].maxdepth, pl.events[w].maxdepth);
+  fprintf(stderr,"capture stalls %ld  events dropped %ld\n",
+          pl.stalls, pl.dropped);
+#endif
+  return(ring_lost(&pl));
+}
+
+/* FNV-1a, 64 bit, of a file for the index (see ix_save) */
+unsigned long long fnv(h, p, n)
+unsigned long long h;
+unsigned char *p;
+long n;
+{
+  while(n-- > 0)
+    h = (h ^ *p++) * 0x100000001b3ULL;
+  return(h);
+}
+#define FNV_START  0xcbf29ce484222325ULL
 
+/*
+ * archive scan, -s.
+ *
+ * every input is a recording of its own, decoded from
+ * start to end as fast as it can be read.  unlike -m the
+ * inputs are not read in step, a sweep of many files is
+ * bound by how many reads are in flight, not by a frame
+ * at a time.
+ *
+ *   reader  ->  detection workers  ->  sink
+ *
+ * the reader keeps SCAN_OPEN files open with a SCAN_CHUNK
+ * read in flight on each, through io_uring if compiled
+ * with -DURING and the kernel has it, else through
+ * SCAN_READERS threads doing pread().  files are opened
+ * O_DIRECT where the file system lets them be, a one
+ * pass sweep gains nothing from the page cache, so the
+ * chunks and their offsets are SCAN_ALIGN aligned.
+ *
+ * a read chunk goes to the worker owning its file (on
+ * the pipeline's frame ring) and its buffer comes back on
+ * the worker's free ring once decoded.  a file has one
+ * read at a time, its chunks arrive in order, and the
+ * frame split between two chunks is carried in the file.
+ * a read may come back short, the file is read on from
+ * where it stopped until its size, or an empty read.
+ */
+#define SCAN_CHUNK    (1 << 20)
+#define SCAN_OPEN     64       /* files read at once */
+#define SCAN_BUFS     128      /* chunks, a power of 2 */
+#define SCAN_ALIGN    4096
+#define SCAN_READERS  16
+
+struct scan_file {
+  char *name;
+  int fd;
+  int bad;                /* could not be read */
+  long long size, mtime;
+  unsigned long long hash;   /* of its contents, for the index */
+  int direct;             /* opened O_DIRECT */
+  long off;               /* of the next read */
+  int w;                  /* the worker owning it */
+};
+
+/* a read, and once done a chunk for a worker */
+struct chunk {
+  int file;
+  char *buf;              /* 0 for the end of the file */
+  int len;                /* bytes read, or -errno */
+};
+
+struct scan {
+  struct pipeline pl;     /* frames[w] carry chunks */
+  struct ring back[MAXWORKERS];   /* buffers back from the workers */
+  struct scan_file *files;
+  int nfiles;
+  char *how;              /* the reads' backend */
+  int (*submit)();        /* (sc, ck, fd, off) start a read */
+  int (*reap)();          /* (sc, ck) wait for one to finish */
+  long reads, bytes;
+#ifdef URING
+  struct uring {
+    int fd;
+    unsigned *head, *tail, *mask, *array;   /* submission */
+    struct io_uring_sqe *sqes;
+    unsigned *chead, *ctail, *cmask;        /* completion */
+    struct io_uring_cqe *cqes;
+    int queued;           /* submitted, not yet entered */
+    struct chunk ck[SCAN_BUFS];
+  } ur;
 #endif
+  struct pool {           /* pread() threads */
+    pthread_mutex_t lock;
+    pthread_cond_t work, done;
+    struct chunk ck[SCAN_BUFS];      /* the requests */
+    int fd[SCAN_BUFS];
+    long off[SCAN_BUFS];
+    unsigned in, out, fin, fout;     /* to do, and done, queues */
+    int todo[SCAN_BUFS], ready[SCAN_BUFS];
+    int stop;
+    pthread_t tid[SCAN_READERS];
+  } pool;
+};
+
+struct scan *the_scan;
+
+/* the buffer's slot, buffers are one block */
+char *scan_bufs;
+#define SLOT(p)  (((p) - scan_bufs) / SCAN_CHUNK)
+
+/*
+ * the thread pool backend
+ */
+void *pool_reader(arg)
+void *arg;
+{
+  struct pool *pp = &((struct scan *)arg)->pool;
+  struct chunk *ck;
+  int s,n,got;
+
+  pthread_mutex_lock(&pp->lock);
+  for(;;) {
+    while(pp->in == pp->out && !pp->stop)
+      pthread_cond_wait(&pp->work, &pp->lock);
+    if(pp->in == pp->out)
+      break;
+    s = pp->todo[pp->out++ & (SCAN_BUFS-1)];
+    pthread_mutex_unlock(&pp->lock);
+    ck = &pp->ck[s];
+    for(got=0, n=0; got < ck->len; got += n)   /* pread may stop short */
+      if((n = pread(pp->fd[s], ck->buf+got, ck->len-got, pp->off[s]+got)) <= 0)
+        break;
+    ck->len = (n < 0 && !got)? -errno: got;
+    pthread_mutex_lock(&pp->lock);
+    pp->ready[pp->fin++ & (SCAN_BUFS-1)] = s;
+    pthread_cond_signal(&pp->done);
+  }
+  pthread_mutex_unlock(&pp->lock);
+  return(0);
+}
+
+pool_submit(sc, ck, fd, off)
+struct scan *sc;
+struct chunk *ck;
+int fd;
+long off;
+{
+  struct pool *pp = &sc->pool;
+  int s = SLOT(ck->buf);
+
+  pthread_mutex_lock(&pp->lock);
+  pp->ck[s] = *ck;
+  pp->fd[s] = fd;
+  pp->off[s] = off;
+  pp->todo[pp->in++ & (SCAN_BUFS-1)] = s;
+  pthread_cond_signal(&pp->work);
+  pthread_mutex_unlock(&pp->lock);
+  return(0);
+}
+
+pool_reap(sc, ck)
+struct scan *sc;
+struct chunk *ck;
+{
+  struct pool *pp = &sc->pool;
+
+  pthread_mutex_lock(&pp->lock);
+  while(pp->fin == pp->fout)
+    pthread_cond_wait(&pp->done, &pp->lock);
+  *ck = pp->ck[pp->ready[pp->fout++ & (SCAN_BUFS-1)]];
+  pthread_mutex_unlock(&pp->lock);
+  return(0);
+}
+
+pool_init(sc)
+struct scan *sc;
+{
+  struct pool *pp = &sc->pool;
+  int i;
+
+  pthread_mutex_init(&pp->lock, 0);
+  pthread_cond_init(&pp->work, 0);
+  pthread_cond_init(&pp->done, 0);
+  for(i=0; i<SCAN_READERS; i++)
+    if(pthread_create(&pp->tid[i], 0, pool_reader, sc))
+      return(0);
+  sc->submit = pool_submit;
+  sc->reap = pool_reap;
+  sc->how = "pread";
+  return(1);
+}
+
+pool_end(sc)
+struct scan *sc;
+{
+  struct pool *pp = &sc->pool;
+  int i;
+
+  if(sc->reap != pool_reap)
+    return(0);
+  pthread_mutex_lock(&pp->lock);
+  pp->stop = 1;
+  pthread_cond_broadcast(&pp->work);
+  pthread_mutex_unlock(&pp->lock);
+  for(i=0; i<SCAN_READERS; i++)
+    pthread_join(pp->tid[i], 0);
+  return(0);
+}
+
+#ifdef URING
+/*
+ * the io_uring backend, with the bare system calls.
+ * reads are queued in the submission ring and entered
+ * together when the reader next waits for one.
+ */
+uring_submit(sc, ck, fd, off)
+struct scan *sc;
+struct chunk *ck;
+int fd;
+long off;
+{
+  struct uring *up = &sc->ur;
+  unsigned tail = *up->tail, i = tail & *up->mask;
+  struct io_uring_sqe *sqe = &up->sqes[i];
+  int s = SLOT(ck->buf);
+
+  up->ck[s] = *ck;
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (unsigned long)ck->buf;
+  sqe->len = ck->len;
+  sqe->off = off;
+  sqe->user_data = s;
+  up->array[i] = i;
+  __atomic_store_n(up->tail, tail + 1, __ATOMIC_RELEASE);
+  up->queued++;
+  return(0);
+}
+
+uring_reap(sc, ck)
+struct scan *sc;
+struct chunk *ck;
+{
+  struct uring *up = &sc->ur;
+  struct io_uring_cqe *cqe;
+  unsigned head;
+
+  for(;;) {
+    head = *up->chead;
+    if(head != __atomic_load_n(up->ctail, __ATOMIC_ACQUIRE))
+      break;
+    if(syscall(__NR_io_uring_enter, up->fd, up->queued, 1,
+               IORING_ENTER_GETEVENTS, 0, 0) < 0 && errno != EINTR) {
+      perror("io_uring_enter");
+      exit(-1);
+    }
+    up->queued = 0;
+  }
+  cqe = &up->cqes[head & *up->cmask];
+  *ck = up->ck[cqe->user_data];
+  ck->len = cqe->res;
+  __atomic_store_n(up->chead, head + 1, __ATOMIC_RELEASE);
+  return(0);
+}
+
+uring_init(sc)
+struct scan *sc;
+{
+  struct uring *up = &sc->ur;
+  struct io_uring_params p;
+  char *sq, *cq;
+
+  memset(&p, 0, sizeof(p));
+  if((up->fd = syscall(__NR_io_uring_setup, SCAN_BUFS, &p)) < 0)
+    return(0);
+  if(!(p.features & IORING_FEAT_FAST_POLL)) {  /* before 5.7, maybe no READ */
+    close(up->fd);
+    return(0);
+  }
+  sq = mmap(0, p.sq_off.array + p.sq_entries * sizeof(unsigned),
+            PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+            up->fd, IORING_OFF_SQ_RING);
+  cq = mmap(0, p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe),
+            PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+            up->fd, IORING_OFF_CQ_RING);
+  up->sqes = mmap(0, p.sq_entries * sizeof(struct io_uring_sqe),
+                  PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                  up->fd, IORING_OFF_SQES);
+  if(sq == MAP_FAILED || cq == MAP_FAILED || up->sqes == MAP_FAILED) {
+    close(up->fd);
+    return(0);
+  }
+  up->head = (unsigned *)(sq + p.sq_off.head);
+  up->tail = (unsigned *)(sq + p.sq_off.tail);
+  up->mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  up->array = (unsigned *)(sq + p.sq_off.array);
+  up->chead = (unsigned *)(cq + p.cq_off.head);
+  up->ctail = (unsigned *)(cq + p.cq_off.tail);
+  up->cmask = (unsigned *)(cq + p.cq_off.ring_mask);
+  up->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  sc->submit = uring_submit;
+  sc->reap = uring_reap;
+  sc->how = "io_uring";
+  return(1);
+}
+#endif /* URING */
+
+/* open fp for the scan, O_DIRECT if it may be */
+scan_open(fp)
+struct scan_file *fp;
+{
+  struct stat st;
+
+  fp->direct = 1;
+  if((fp->fd = open(fp->name, O_RDONLY|O_DIRECT)) < 0) {
+    fp->direct = 0;
+    fp->fd = open(fp->name, O_RDONLY);
+  }
+  if(fp->fd < 0 || fstat(fp->fd, &st) < 0) {
+    perror(fp->name);
+    fp->bad = 1;
+    return(0);
+  }
+  fp->size = st.st_size;
+  fp->mtime = st.st_mtime;
+  fp->hash = FNV_START;
+  return(1);
+}
+
+/*
+ * detection worker for the scan, decodes the chunks
+ * of the files it owns
+ */
+void *scan_worker(arg)
+void *arg;
+{
+  struct worker *wp = (struct worker *)arg;
+  struct scan *sc = (struct scan *)wp->pl;
+  struct ring *in = &sc->pl.frames[wp->w], *out = &sc->pl.events[wp->w];
+  struct chunk *ck;
+  struct scan_file *fp;
+  struct detector *dp;
+  struct event *ev, e[4*MAXEVENTS];
+  char *p, *end, **slot;
+  int i,n,idle = 0;
+
+  for(;;) {
+    if(!(ck = (struct chunk *)ring_rslot(in))) {
+      if(ring_drained(in))
+        break;
+      ring_idle(&idle);
+      continue;
+    }
+    idle = 0;
+    fp = &sc->files[ck->file];
+    dp = &sc->pl.dp[ck->file];
+    p = ck->buf;
+    end = p + ck->len;
+    if(p)
+      fp->hash = fnv(fp->hash, p, (long)ck->len);
+    do {
+      if(!ck->buf)       /* the end of the file */
+        n = det_end(dp, e);
+      else               /* what is left of a frame waits in dp */
+        p += det_feed(dp, p, end - p, e, 4*MAXEVENTS, &n);
+      for(i=0; i<n; i++) {
+        for(idle=0; the_index && !(ev = (struct event *)ring_wslot(out)); )
+          ring_idle(&idle);   /* an index has to have them all */
+        if(!(ev = (struct event *)ring_wslot(out))) {
+          __sync_fetch_and_add(&sc->pl.dropped, 1);
+          continue;
+        }
+        *ev = e[i];
+        ring_push(out);
+      }
+    } while(p < end);
+    if(ck->buf) {        /* back to the reader, never full */
+      slot = (char **)ring_wslot(&sc->back[wp->w]);
+      *slot = ck->buf;
+      ring_push(&sc->back[wp->w]);
+    }
+    ring_pop(in);
+  }
+  ring_finish(out);
+  return(0);
+}
+
+/* chunk ck to the worker owning its file */
+scan_hand(sc, ck)
+struct scan *sc;
+struct chunk *ck;
+{
+  struct ring *rp = &sc->pl.frames[sc->files[ck->file].w];
+  struct chunk *cp;
+  int idle;
+
+  if(!(cp = (struct chunk *)ring_wslot(rp))) {
+    sc->pl.stalls++;
+    for(idle=0; !(cp = (struct chunk *)ring_wslot(rp)); )
+      ring_idle(&idle);
+  }
+  *cp = *ck;
+  ring_push(rp);
+  return(0);
+}
+
+/*
+ * scan the files names[0..nfiles-1], dp[f] is file f.
+ * reading runs on the calling thread.  returns 1 if
+ * events were dropped, -1 if the threads or buffers
+ * can not be had.
+ */
+scan_to_ascii(dp, names, nfiles, sp, nworkers)
+struct detector *dp;
+char **names;
+int nfiles;
+struct sink *sp;
+int nworkers;
+{
+  static struct scan sc;
+  struct worker wk[MAXWORKERS];
+  pthread_t tid[MAXWORKERS], sink;
+  struct scan_file *fp;
+  struct chunk ck;
+  char *freebuf[SCAN_BUFS], **slot;
+  int wait[SCAN_OPEN], first = 0, nwait = 0;   /* files for a buffer */
+  int nfree, inflight = 0, next = 0, nopen = 0, w, f, idle = 0;
+
+  if(nworkers > nfiles)
+    nworkers = nfiles;
+  if(nworkers > MAXWORKERS)
+    nworkers = MAXWORKERS;
+  if(posix_memalign((void **)&scan_bufs, SCAN_ALIGN,
+                    (size_t)SCAN_BUFS * SCAN_CHUNK))
+    return(-1);
+  for(nfree=0; nfree<SCAN_BUFS; nfree++)
+    freebuf[nfree] = scan_bufs + (long)nfree * SCAN_CHUNK;
+  sc.files = (struct scan_file *)calloc(nfiles, sizeof(struct scan_file));
+  sc.nfiles = nfiles;
+  for(f=0; f<nfiles; f++) {
+    sc.files[f].name = names[f];
+    sc.files[f].fd = -1;
+    sc.files[f].w = f % nworkers;
+  }
+  sc.pl.dp = dp;
+  sc.pl.nchan = nfiles;
+  sc.pl.nworkers = nworkers;
+  sc.pl.out = sp;
+  the_pipeline = &sc.pl;
+  the_scan = &sc;
+#ifdef URING
+  if(!uring_init(&sc))
+#endif
+    if(!pool_init(&sc))
+      return(-1);
+  for(w=0; w<nworkers; w++) {
+    if(!ring_init(&sc.pl.frames[w], 2*SCAN_BUFS, sizeof(struct chunk)) ||
+       !ring_init(&sc.pl.events[w], EVENT_SLOTS, sizeof(struct event)) ||
+       !ring_init(&sc.back[w], SCAN_BUFS, sizeof(char *)))
+      return(-1);
+    wk[w].pl = &sc.pl;
+    wk[w].w = w;
+    if(pthread_create(&tid[w], 0, scan_worker, &wk[w]))
+      return(-1);
+  }
+  if(pthread_create(&sink, 0, event_sink, &sc.pl))
+    return(-1);
+
+  for(;;) {
+    for(w=0; w<nworkers; w++)          /* buffers decoded */
+      while((slot = (char **)ring_rslot(&sc.back[w]))) {
+        freebuf[nfree++] = *slot;
+        ring_pop(&sc.back[w]);
+      }
+    while(nopen < SCAN_OPEN && next < nfiles)
+      if(scan_open(&sc.files[next++])) {
+        wait[(first + nwait++) % SCAN_OPEN] = next-1;
+        nopen++;
+      }
+    while(nwait && nfree) {            /* the next read of a file */
+      ck.file = wait[first];
+      first = (first + 1) % SCAN_OPEN;
+      nwait--;
+      ck.buf = freebuf[--nfree];
+      ck.len = SCAN_CHUNK;
+      fp = &sc.files[ck.file];
+      (*sc.submit)(&sc, &ck, fp->fd, fp->off);
+      inflight++;
+    }
+    if(!inflight) {
+      if(!nopen && next >= nfiles)
+        break;
+      ring_idle(&idle);                /* for a buffer to come back */
+      continue;
+    }
+    idle = 0;
+    (*sc.reap)(&sc, &ck);
+    inflight--;
+    fp = &sc.files[ck.file];
+    if(ck.len == -EINVAL && fp->direct) {   /* O_DIRECT after all not */
+      close(fp->fd);
+      fp->direct = 0;
+      if((fp->fd = open(fp->name, O_RDONLY)) >= 0) {
+        freebuf[nfree++] = ck.buf;
+        wait[(first + nwait++) % SCAN_OPEN] = ck.file;
+        continue;
+      }
+      ck.len = -errno;
+    }
+    if(ck.len < 0) {
+      errno = -ck.len;
+      perror(fp->name);
+      fp->bad = 1;
+      ck.len = 0;
+    }
+    sc.reads++;
+    sc.bytes += ck.len;
+    fp->off += ck.len;
+    if(ck.len)
+      scan_hand(&sc, &ck);
+    else
+      freebuf[nfree++] = ck.buf;
+    if(ck.len && fp->off < fp->size)   /* more to come */
+      wait[(first + nwait++) % SCAN_OPEN] = ck.file;
+    else {
+      close(fp->fd);
+      fp->fd = -1;
+      nopen--;
+      ck.buf = 0;
+      ck.len = 0;
+      scan_hand(&sc, &ck);
+    }
+  }
+
+  pool_end(&sc);
+  for(w=0; w<nworkers; w++)
+    ring_finish(&sc.pl.frames[w]);
+  for(w=0; w<nworkers; w++)
+    pthread_join(tid[w], 0);
+  pthread_join(sink, 0);
+  the_pipeline = 0;
+#ifdef STATS
+  fprintf(stderr,"scan %s  reads %ld  bytes %ld  worker stalls %ld  "
+          "events dropped %ld\n", sc.how, sc.reads, sc.bytes,
+          sc.pl.stalls, sc.pl.dropped);
+#endif
+  return(ring_lost(&sc.pl));
+}
+/*
+ * the event index, -x file (a scan).
+ *
+ * a scan can leave its events in an index beside the
+ * archive, so questions about the archive (see query.c)
+ * need not decode it again.  the index is one file, laid
+ * out to be mapped and used in place:
+ *
+ *   struct ix_head
+ *   struct ix_file [nfiles]     sorted by name
+ *   struct record  [nevents]    a file's together, in order
+ *   the names                   NUL terminated
+ *
+ * a record's chan is its file's number in the table, the
+ * records are whole tones, as -f bin writes them (caller
+ * ID keeps its code, not its text).  a file is entered
+ * with its size, mtime and a hash of its contents, and
+ * the key of the detector that decoded it, DET_VERSION
+ * and the options that change what is found.
+ *
+ * -x with an index that exists only decodes the inputs
+ * that are new to it or stale (other size, mtime or key),
+ * the rest keep their events, as do the files of the
+ * index that are not inputs.  an input that can not be
+ * read is taken out.  the new index replaces the old
+ * one by a rename, a reader never sees half of one.
+ */
+#define IX_VERSION   2
+#define DET_VERSION  46    /* up it when the detector finds other things */
+
+struct ix_head {
+  char magic[4];          /* DTIX */
+  int version;            /* IX_VERSION */
+  int detector;           /* DET_VERSION of the writer */
+  unsigned key;           /* of the writer's detector and options */
+  char opts[128];         /* the writer's options, for a rebuild */
+  int nfiles;
+  int pad;
+  long long nevents;
+  long long names;        /* offset of the names */
+};
+
+struct ix_file {
+  long long size, mtime;
+  unsigned long long hash;
+  long long first;        /* its first record */
+  int nevents;
+  unsigned key;
+  long long name;         /* offset of its name */
+};
+
+char ix_magic[4] = { 'D', 'T', 'I', 'X' };
+
+struct ix {
+  char *path;
+  struct ix_head *head;   /* the index as it was, mapped, or 0 */
+  long len;
+  struct ix_file *files;
+  struct record *rec;
+  char *names;
+  char *gone;             /* [file] of the old index, replaced */
+  unsigned key;
+  char opts[128];
+  struct record *ev;      /* the scan's, chan is the input */
+  long nev, size;
+};
+
+/* a file of the new index, an old entry or a scanned one */
+struct ix_out {
+  char *name;
+  struct ix_file f;
+  struct record *ev;
+};
+
+/*
+ * does the index of 'len' bytes at h hold together: the
+ * files table, the records and the names inside it, and
+ * each file's events and name inside them
+ */
+ix_sound(h, len)
+struct ix_head *h;
+long len;
+{
+  struct ix_file *files = (struct ix_file *)(h + 1);
+  long long left = len - (long long)sizeof(*h), nnames;
+  char *names;
+  int f;
+
+  if(h->nfiles < 0 || h->nevents < 0 ||
+     h->nfiles > left / (long long)sizeof(struct ix_file))
+    return(0);
+  left -= h->nfiles * (long long)sizeof(struct ix_file);
+  if(h->nevents > left / (long long)sizeof(struct record))
+    return(0);
+  left -= h->nevents * (long long)sizeof(struct record);
+  if(h->names != len - left)
+    return(0);
+  names = (char *)h + h->names;
+  nnames = left;
+  for(f=0; f<h->nfiles; f++)
+    if(files[f].first < 0 || files[f].nevents < 0 ||
+       files[f].first > h->nevents - files[f].nevents ||
+       files[f].name < 0 || files[f].name >= nnames ||
+       !memchr(names + files[f].name, 0, nnames - files[f].name))
+      return(0);
+  return(1);
+}
+
+/*
+ * index 'path' for a scan with profile pp, the old
+ * index is mapped if there is one.  -1 if the options
+ * do not fit the index (see query's rebuild)
+ */
+ix_open(ix, path, pp)
+struct ix *ix;
+char *path;
+struct profile *pp;
+{
+  struct stat st;
+  char key[160];
+  void *map;
+  int fd;
+
+  memset(ix, 0, sizeof(*ix));
+  ix->path = path;
+  if(snprintf(ix->opts, sizeof(ix->opts), "-p %s%s%s%s", pp->name,
+              callerid? " -c": "", levels_arg? " -L ": "",
+              levels_arg? levels_arg: "") >= sizeof(ix->opts) ||
+     (levels_arg && strpbrk(levels_arg, " \t"))) {
+    fprintf(stderr, "%s: -L %s does not fit an index\n", path, levels_arg);
+    return(-1);
+  }
+  sprintf(key, "%d %s", DET_VERSION, ix->opts);
+  ix->key = fnv(FNV_START, key, (long)strlen(key));
+  if((fd = open(path, O_RDONLY)) < 0)
+    return(0);
+  if(fstat(fd, &st) == 0 && st.st_size >= sizeof(struct ix_head) &&
+     (map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) != MAP_FAILED) {
+    ix->head = (struct ix_head *)map;
+    ix->len = st.st_size;
+    if(memcmp(ix->head->magic, ix_magic, 4) ||
+       ix->head->version != IX_VERSION || !ix_sound(ix->head, ix->len)) {
+      fprintf(stderr, "%s: not an index, it will be replaced\n", path);
+      munmap(map, st.st_size);
+      ix->head = 0;
+    } else {
+      ix->files = (struct ix_file *)(ix->head + 1);
+      ix->rec = (struct record *)(ix->files + ix->head->nfiles);
+      ix->names = (char *)map + ix->head->names;
+      ix->gone = calloc(ix->head->nfiles + 1, 1);
+    }
+  }
+  close(fd);
+  return(0);
+}
+
+/* the number of 'name' in the old index, or -1 */
+ix_find(ix, name)
+struct ix *ix;
+char *name;
+{
+  int lo = 0, hi, mid, c;
+
+  if(!ix->head)
+    return(-1);
+  for(hi=ix->head->nfiles-1; lo <= hi; ) {
+    mid = (lo + hi) / 2;
+    if(!(c = strcmp(name, ix->names + ix->files[mid].name)))
+      return(mid);
+    if(c < 0)
+      hi = mid - 1;
+    else
+      lo = mid + 1;
+  }
+  return(-1);
+}
+
+/*
+ * 1 if the index has input 'name' as it is now, else
+ * its entry (if any) is to be replaced by the scan.
+ * with 'rescan' every input is
+ */
+ix_fresh(ix, name, rescan)
+struct ix *ix;
+char *name;
+int rescan;
+{
+  struct stat st;
+  struct ix_file *fp;
+  int f;
+
+  if((f = ix_find(ix, name)) < 0)
+    return(0);
+  fp = &ix->files[f];
+  if(!rescan && stat(name, &st) == 0 && fp->key == ix->key &&
+     fp->size == st.st_size && fp->mtime == st.st_mtime)
+    return(1);
+  ix->gone[f] = 1;
+  return(0);
+}
+
+/* an event of the scan, on the sink thread */
+ix_add(ix, ev)
+struct ix *ix;
+struct event *ev;
+{
+  struct record *r;
+
+  if(ix->nev == ix->size) {
+    ix->size = 2*ix->size + 4096;
+    if(!(ix->ev = realloc(ix->ev, ix->size * sizeof(struct record)))) {
+      perror("index");
+      exit(-1);
+    }
+  }
+  r = &ix->ev[ix->nev++];
+  r->chan = ev->chan;
+  r->code = ev->code;
+  r->start = ev->start;
+  r->end = ev->end;
+  r->peak[0] = ev->peak[0];
+  r->peak[1] = ev->peak[1];
+  return(0);
+}
+
+ix_cmp(a, b)
+struct ix_out *a, *b;
+{
+  return(strcmp(a->name, b->name));
+}
+
+/*
+ * write the index: the old one's entries that are still
+ * good and the files of scan sc (which may be 0)
+ */
+ix_save(ix, sc)
+struct ix *ix;
+struct scan *sc;
+{
+  struct ix_out *out;
+  struct ix_head h;
+  struct record r, *ev;
+  long long first, names;
+  long *start, i;
+  int nold = ix->head? ix->head->nfiles: 0;
+  int nnew = sc? sc->nfiles: 0;
+  int n, f, c;
+  char tmp[4096];
+  FILE *fp;
+
+  out = (struct ix_out *)malloc((nold + nnew + 1) * sizeof(*out));
+  for(f=0, n=0; f<nold; f++)
+    if(!ix->gone[f]) {
+      out[n].name = ix->names + ix->files[f].name;
+      out[n].f = ix->files[f];
+      out[n++].ev = ix->rec + ix->files[f].first;
+    }
+  /* the scan's events, in input order (a stable count sort) */
+  start = (long *)calloc(nnew + 1, sizeof(long));
+  ev = (struct record *)malloc((ix->nev + 1) * sizeof(struct record));
+  for(i=0; i<ix->nev; i++)
+    start[ix->ev[i].chan + 1]++;
+  for(c=0; c<nnew; c++)
+    start[c+1] += start[c];
+  for(i=0; i<ix->nev; i++)
+    ev[start[ix->ev[i].chan]++] = ix->ev[i];
+  for(c=0, i=0; c<nnew; c++) {
+    if(!sc->files[c].bad) {
+      out[n].name = sc->files[c].name;
+      out[n].f.size = sc->files[c].size;
+      out[n].f.mtime = sc->files[c].mtime;
+      out[n].f.hash = sc->files[c].hash;
+      out[n].f.key = ix->key;
+      out[n].f.nevents = start[c] - i;
+      out[n++].ev = ev + i;
+    }
+    i = start[c];
+  }
+  qsort(out, n, sizeof(*out), ix_cmp);
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, ix_magic, 4);
+  h.version = IX_VERSION;
+  h.detector = DET_VERSION;
+  h.key = ix->key;
+  memcpy(h.opts, ix->opts, sizeof(h.opts));
+  h.nfiles = n;
+  for(f=0, first=0, names=0; f<n; f++) {
+    out[f].f.first = first;
+    out[f].f.name = names;
+    first += out[f].f.nevents;
+    names += strlen(out[f].name) + 1;
+  }
+  h.nevents = first;
+  h.names = sizeof(h) + n * sizeof(struct ix_file) + first * sizeof(r);
+
+  snprintf(tmp, sizeof(tmp), "%s.new", ix->path);
+  if(!(fp = fopen(tmp, "w"))) {
+    perror(tmp);
+    return(-1);
+  }
+  fwrite(&h, sizeof(h), 1, fp);
+  for(f=0; f<n; f++)
+    fwrite(&out[f].f, sizeof(struct ix_file), 1, fp);
+  for(f=0; f<n; f++)
+    for(c=0; c<out[f].f.nevents; c++) {
+      r = out[f].ev[c];
+      r.chan = f;
+      fwrite(&r, sizeof(r), 1, fp);
+    }
+  for(f=0; f<n; f++)
+    fwrite(out[f].name, strlen(out[f].name) + 1, 1, fp);
+  if(fclose(fp) || rename(tmp, ix->path) < 0) {
+    perror(ix->path);
+    return(-1);
+  }
+  return(0);
+}
+#endif /* THREADS */
+
+#ifdef METRICS
+/*
+ * the metrics, as prometheus text.  -M file has them
+ * written to 'file' every 'metrics_every' seconds
+ * (-i secs) and at the end, by way of a rename so a
+ * scraper never sees half of it.  each time a one
+ * line summary goes to stderr as well.
+ */
+char *metrics_file;
+int metrics_every = 10;
+
+char *stage_name[] = { "read", "decode", "write" };
+
+metrics_dump(fp)
+FILE *fp;
+{
+  struct counts sum;
+  long n;
+  int s,b,k;
+
+  counts_sum(&sum);
+  fprintf(fp, "# HELP dtmf_frames_total Frames decoded, by result.\n");
+  fprintf(fp, "# TYPE dtmf_frames_total counter\n");
+  fprintf(fp, "dtmf_frames_total{result=\"silence\"} %ld\n", sum.silence);
+  fprintf(fp, "dtmf_frames_total{result=\"invalid\"} %ld\n", sum.invalid);
+  fprintf(fp, "dtmf_frames_total{result=\"tone\"} %ld\n", sum.tones);
+  fprintf(fp, "# HELP dtmf_cascade_total Frames finished by each stage of the cascade.\n");
+  fprintf(fp, "# TYPE dtmf_cascade_total counter\n");
+  fprintf(fp, "dtmf_cascade_total{stage=\"gate\"} %ld\n", sum.gated);
+  fprintf(fp, "dtmf_cascade_total{stage=\"prescreen\"} %ld\n", sum.screened);
+  fprintf(fp, "dtmf_cascade_total{stage=\"bank\"} %ld\n", sum.bank);
+  fprintf(fp, "# HELP dtmf_rejected_total DTMF frames failed by the twist and talk-off checks.\n");
+  fprintf(fp, "# TYPE dtmf_rejected_total counter\n");
+  fprintf(fp, "dtmf_rejected_total %ld\n", sum.rejected);
+
+  fprintf(fp, "# HELP dtmf_stage_seconds Time spent per pass of each stage.\n");
+  fprintf(fp, "# TYPE dtmf_stage_seconds histogram\n");
+  for(s=0; s<NSTAGES; s++) {
+    for(b=0, n=0; b<NBUCKETS-1; b++) {
+      n += sum.hist[s][b];
+      fprintf(fp, "dtmf_stage_seconds_bucket{stage=\"%s\",le=\"%g\"} %ld\n",
+              stage_name[s], (256L << b) * 1e-9, n);
+    }
+    fprintf(fp, "dtmf_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %ld\n",
+            stage_name[s], sum.stage_n[s]);
+    fprintf(fp, "dtmf_stage_seconds_sum{stage=\"%s\"} %g\n",
+            stage_name[s], sum.stage_ns[s] * 1e-9);
+    fprintf(fp, "dtmf_stage_seconds_count{stage=\"%s\"} %ld\n",
+            stage_name[s], sum.stage_n[s]);
+  }
+
+  fprintf(fp, "# HELP dtmf_kernel_ns_per_frame Goertzel kernel time per channel frame.\n");
+  fprintf(fp, "# TYPE dtmf_kernel_ns_per_frame gauge\n");
+  for(k=0; k<MAXKERNELS; k++) {
+    if(!sum.kernel_n[k])
+      continue;
+    fprintf(fp, "dtmf_kernel_ns_per_frame{kernel=\"%s\"} %.1f\n",
+            (k == K_BATCH)? "batch": profiles[k].name,
+            (double)sum.kernel_ns[k] / sum.kernel_n[k]);
+  }
+  fprintf(fp, "# HELP dtmf_batch_kernel_info The batch kernel in use, its lanes and where the choice came from.\n");
+  fprintf(fp, "# TYPE dtmf_batch_kernel_info gauge\n");
+  fprintf(fp, "dtmf_batch_kernel_info{kernel=\"%s\",lanes=\"%d\",from=\"%s\"} 1\n",
+          the_kernel->name, batch_lanes, tune_from);
+  if(the_kernel->ns > 0.0) {
+    fprintf(fp, "# HELP dtmf_batch_kernel_tuned_ns Its time a channel frame when it was tuned.\n");
+    fprintf(fp, "# TYPE dtmf_batch_kernel_tuned_ns gauge\n");
+    fprintf(fp, "dtmf_batch_kernel_tuned_ns %.1f\n", the_kernel->ns);
+  }
+
+#ifdef THREADS
+  if(the_pipeline) {
+    fprintf(fp, "# HELP dtmf_queue_depth Slots in use in the pipeline rings.\n");
+    fprintf(fp, "# TYPE dtmf_queue_depth gauge\n");
+    for(k=0; k<the_pipeline->nworkers; k++) {
+      fprintf(fp, "dtmf_queue_depth{ring=\"frames\",worker=\"%d\"} %u\n", k,
+              the_pipeline->frames[k].head - the_pipeline->frames[k].tail);
+      fprintf(fp, "dtmf_queue_depth{ring=\"events\",worker=\"%d\"} %u\n", k,
+              the_pipeline->events[k].head - the_pipeline->events[k].tail);
+    }
+    fprintf(fp, "# TYPE dtmf_capture_stalls_total counter\n");
+    fprintf(fp, "dtmf_capture_stalls_total %ld\n", the_pipeline->stalls);
+    fprintf(fp, "# TYPE dtmf_events_dropped_total counter\n");
+    fprintf(fp, "dtmf_events_dropped_total %ld\n", the_pipeline->dropped);
+  }
+#endif
+  return(0);
+}
+
+metrics_write()
+{
+  struct counts sum;
+  char tmp[1024];
+  FILE *fp;
+
+  if(metrics_file) {
+    snprintf(tmp, sizeof(tmp), "%s.tmp", metrics_file);
+    if(!(fp = fopen(tmp, "w"))) {
+      perror(tmp);
+      return(-1);
+    }
+    metrics_dump(fp);
+    fclose(fp);
+    rename(tmp, metrics_file);
+  }
+  counts_sum(&sum);
+  fprintf(stderr, "frames %ld: silence %ld invalid %ld tone %ld, "
+          "decode %.0f ns/pass\n", sum.frames, sum.silence, sum.invalid,
+          sum.tones, sum.stage_n[S_DECODE]?
+          (double)sum.stage_ns[S_DECODE] / sum.stage_n[S_DECODE]: 0.0);
+  return(0);
+}
+
+/* called by the output side, writes the metrics when it is time */
+metrics_tick()
+{
+  static long next;
+  long now;
+
+  if(!metrics_file)
+    return(0);
+  now = now_ns();
+  if(now < next)
+    return(0);
+  if(next)
+    metrics_write();
+  next = now + metrics_every * 1000000000L;
+  return(0);
+}
+#endif /* METRICS */
+
+#ifdef THREADS
+/*
+ * the names of the inputs, one a line on stdin, into
+ * (*argv)[1..], returns argc or 0 for none
+ */
+read_names(argv)
+char ***argv;
+{
+  char line[4096], **v = 0;
+  int n = 1, size = 0;
+
+  while(fgets(line, sizeof(line), stdin)) {
+    line[strcspn(line, "\n")] = 0;
+    if(!line[0])
+      continue;
+    if(n >= size)
+      v = (char **)realloc(v, (size = 2*size + 64) * sizeof(char *));
+    v[n++] = strdup(line);
+  }
+  if(n == 1)
+    return(0);
+  v[0] = (*argv)[0];
+  *argv = v;
+  return(n);
+}
+#endif
+
+/*
+ * the batch kernel.  -K name[,lanes] sets it, else
+ * det_tune() finds the fastest for this host, or has
+ * it in $DTMF_TUNE (~/.dtmf_tune, none if it is set
+ * empty).  -K tune times them again and shows it.
+ */
+char *kernel_arg;
+
+pick_kernel()
+{
+  static char path[1024];
+  char *cache = getenv("DTMF_TUNE"), *home = getenv("HOME");
+  int force = kernel_arg != 0;
+
+  if(kernel_arg && strcmp(kernel_arg, "tune"))
+    return(0);                /* set already */
+  if(!cache && home) {
+    snprintf(path, sizeof(path), "%s/.dtmf_tune", home);
+    cache = path;
+  }
+  if(cache && !*cache)
+    cache = 0;
+  if(det_tune(cache, force, force) < 0)
+    perror(cache);            /* not kept, but tuned */
+#ifdef STATS
+  fprintf(stderr,"kernel %s  lanes %d  (%s)\n",
+          the_kernel->name, batch_lanes, tune_from);
+#endif
+  return(0);
+}
+
+usage(prog)
+char *prog;
+{
+  fprintf(stderr,"usage:  %s [options] [input [output]]\n",prog);
+  fprintf(stderr,"        %s [options] -m input...\n",prog);
+  fprintf(stderr,"        %s [options] -r capture\n",prog);
+#ifdef THREADS
+  fprintf(stderr,"        %s [options] -s [input...]\n",prog);
+  fprintf(stderr,"  -t workers  decode on worker threads\n");
+  fprintf(stderr,"  -s          scan an archive, input names on stdin if none\n");
+  fprintf(stderr,"  -x index    scan into an event index, see query\n");
+  fprintf(stderr,"  -X index    the same, every input decoded again\n");
+#endif
+#ifdef METRICS
+  fprintf(stderr,"  -M file     write prometheus metrics to file\n");
+  fprintf(stderr,"  -i secs     every secs seconds (10)\n");
+#endif
+  fprintf(stderr,"  -p profile  full dtmf mf cp cid fax\n");
+  fprintf(stderr,"  -c          decode caller ID too\n");
+  fprintf(stderr,"  -e          early DTMF decisions, one channel only\n");
+  fprintf(stderr,"  -f format   text json bin\n");
+  fprintf(stderr,"  -F flush    event, full or every n ms\n");
+  fprintf(stderr,"  -P file     dump every frame's tone powers to file\n");
+  fprintf(stderr,"  -L levels   thresh= range= adapt=dB twist=dB rtwist=dB share= harm=\n");
+  fprintf(stderr,"  -R file     with -m, capture the input to file\n");
+  fprintf(stderr,"  -r file     decode a capture, as -m does its inputs\n");
+  fprintf(stderr,"  -S speed    of the replay, 1 real time, 0 flat out\n");
+  fprintf(stderr,"  -K kernel   batch kernel[,lanes] or tune, see det_tune\n");
+  fprintf(stderr,"  -T file     trace the frames' stages to file, chrome JSON\n");
+  return(-1);
+}
+
+main(argc,argv) 
+int argc;
+char **argv;
+{
+  struct detector det, *dets;
+  struct wav wav;
+  struct profile *pp = &profiles[0];
+  struct counts sum;
+  static struct sink snk;
+  static struct specfile dump;
+  FILE *output;
+  int input, *fds, multi = 0, scan = 0, workers = 0, c, n;
+  char *index = 0;
+  int rescan = 0, status = 0;
+  static struct capture cap;
+  static struct replay rep;
+  char *cap_name = 0, *rep_name = 0;
+  double speed = 1.0;
+#ifdef THREADS
+  struct ix ix;
+#endif
+  char *prog = argv[0];
+#ifdef NOFLUSH
+  int policy = P_FULL;
+#else
+  int policy = P_EVENT;
+#endif
+
+  levels_init(&levels);
+  for(; argc > 1 && argv[1][0] == '-' && argv[1][1]; argc--, argv++) {
+    if(!strcmp(argv[1], "-m"))
+      multi = 1;
+    else if(!strcmp(argv[1], "-c"))
+      callerid = 1;
+    else if(!strcmp(argv[1], "-e"))
+      early = 1;
+#ifdef THREADS
+    else if(!strcmp(argv[1], "-s"))
+      scan = 1;
+    else if((!strcmp(argv[1], "-x") || !strcmp(argv[1], "-X")) &&
+            argc > 2) {
+      index = argv[2];
+      rescan = argv[1][1] == 'X';
+      scan = 1;
+      argc--;
+      argv++;
+    }
+    else if(!strcmp(argv[1], "-t") && argc > 2 &&
+            (workers = atoi(argv[2])) > 0) {
+      argc--;
+      argv++;
+    }
+#endif
+#ifdef METRICS
+    else if(!strcmp(argv[1], "-M") && argc > 2) {
+      metrics_file = argv[2];
+      argc--;
+      argv++;
+    } else if(!strcmp(argv[1], "-i") && argc > 2 &&
+              (metrics_every = atoi(argv[2])) > 0) {
+      argc--;
+      argv++;
+    }
+#endif
+    else if(!strcmp(argv[1], "-p") && argc > 2 &&
+            (pp = find_profile(argv[2]))) {
+      argc--;
+      argv++;
+    } else if(!strcmp(argv[1], "-f") && argc > 2) {
+      if(!strcmp(argv[2], "json"))
+        out_format = F_JSON;
+      else if(!strcmp(argv[2], "bin"))
+        out_format = F_BIN;
+      else if(strcmp(argv[2], "text"))
+        return(usage(prog));
+      if(out_format != F_TEXT)   /* not for a person to watch */
+        policy = P_FULL;
+      argc--;
+      argv++;
+    } else if(!strcmp(argv[1], "-P") && argc > 2) {
+      if((c = open(argv[2], O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0 ||
+         spec_open(&dump, c) < 0) {
+        perror(argv[2]);
+        return(-1);
+      }
+      the_dump = &dump;
+      argc--;
+      argv++;
+    } else if(!strcmp(argv[1], "-L") && argc > 2) {
+      if(levels_parse(&levels, argv[2]) < 0)
+        return(usage(prog));
+      levels_arg = argv[2];
+      argc--;
+      argv++;
+    } else if(!strcmp(argv[1], "-K") && argc > 2) {
+      if(strcmp(argv[2], "tune") && set_kernel(argv[2]) < 0)
+        return(usage(prog));
+      kernel_arg = argv[2];
+      argc--;
+      argv++;
+    } else if(!strcmp(argv[1], "-T") && argc > 2) {
+      trace_file = argv[2];
+      tracing = 1;
+      argc--;
+      argv++;
+    } else if(!strcmp(argv[1], "-R") && argc > 2) {
+      cap_name = argv[2];
+      argc--;
+      argv++;
+    } else if(!strcmp(argv[1], "-r") && argc > 2) {
+      rep_name = argv[2];
+      multi = 1;
+      argc--;
+      argv++;
+    } else if(!strcmp(argv[1], "-S") && argc > 2) {
+      if((speed = atof(argv[2])) < 0)
+        return(usage(prog));
+      argc--;
+      argv++;
+    } else if(!strcmp(argv[1], "-F") && argc > 2) {
+      if(!strcmp(argv[2], "event"))
+        policy = P_EVENT;
+      else if(!strcmp(argv[2], "full"))
+        policy = P_FULL;
+      else if((policy = atoi(argv[2])) <= 0)
+        return(usage(prog));
+      argc--;
+      argv++;
+    } else
+      return(usage(prog));
+  }
+  det_lib_init();
+
+#ifdef THREADS
+  if(scan) {        /* one channel per file, read in chunks */
+    if(argc < 2 && !(argc = read_names(&argv)))
+      return(usage(prog));
+    if(index) {      /* only what the index does not have */
+      if(ix_open(&ix, index, pp) < 0)
+        return(-1);
+      for(c=1, n=1; c<argc; c++)
+        if(!ix_fresh(&ix, argv[c], rescan))
+          argv[n++] = argv[c];
+      argc = n;
+      the_index = &ix;
+    }
+    output = stdout;
+    sink_open(&snk, output, policy);
+    if(index)        /* whole tones, as for -f bin */
+      out_format = F_BIN;
+    dets = (struct detector *)malloc(argc * sizeof(*dets));
+    for(c=0; c<argc-1; c++)
+      chan_init(&dets[c], pp, c);
+    if(!workers)
+      workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if(argc > 1 &&
+       (status = scan_to_ascii(dets, argv+1, argc-1, &snk, workers)) < 0) {
+      perror("scan");
+      return(-1);
+    }
+    if(index && ix_save(&ix, the_scan) < 0)
+      return(-1);
+  } else
+#endif
+  if(multi) {       /* one channel per input */
+    if(rep_name) {   /* or per channel of the capture */
+      if(argc > 1)
+        return(usage(prog));
+      if(replay_open(&rep, rep_name, speed) < 0)
+        return(-1);
+      the_replay = &rep;
+      n = rep.nchan;
+    } else if((n = argc-1) < 1)
+      return(usage(prog));
+    dets = (struct detector *)malloc(n * sizeof(*dets));
+    fds = (int *)malloc(n * sizeof(int));
+    for(c=0; c<n; c++) {
+      chan_init(&dets[c], pp, c);
+      fds[c] = rep_name? c: open(argv[c+1],0);
+      if(fds[c] < 0) {
+        perror(argv[c+1]);
+        return(-1);
+      }
+    }
+    if(cap_name) {
+      if(cap_open(&cap, cap_name, n) < 0) {
+        perror(cap_name);
+        return(-1);
+      }
+      the_capture = &cap;
+    }
+    output = stdout;
+    sink_open(&snk, output, policy);
+    pick_kernel();
+#ifdef THREADS
+    if(!workers || (status = pipe_to_ascii(dets, fds, n, &snk, workers)) < 0)
+#endif
+      multi_to_ascii(dets, fds, n, &snk);
+    if(the_capture && cap_close(&cap, cap_name) < 0)
+      return(-1);
+  } else if(cap_name)
+    return(usage(prog));
+  else {
+    chan_init(&det, pp, -1);
+    input = 0;
+    output = stdout;
+    switch(argc) {
+      case 1:  break;
+      case 3:  output = fopen(argv[2],"w");
+               if(!output) {
+                 perror(argv[2]);
+                 return(-1);
+               }
+               /* fall through */
+      case 2:  input = open(argv[1],0);
+               if(input < 0) {
+                 perror(argv[1]);
+                 return(-1);
+               }
+               break;
+       default:
+          return(usage(prog));
+    }
+    sink_open(&snk, output, policy);
+    if((c = wav_open(input, &wav)) < 0)
+      return(-1);
+    if(c) {              /* a .wav, a detector for each channel */
+      dets = (struct detector *)malloc(wav.nchan * sizeof(*dets));
+      for(c=0; c<wav.nchan; c++) {
+        chan_init(&dets[c], pp, (wav.nchan > 1)? c: -1);
+        dets[c].delay = wav.rs? wav.rs->delay: 0;
+      }
+      pick_kernel();
+      wav_to_ascii(dets, input, &wav, &snk);
+    } else
+#ifdef THREADS
+    if(workers && (status = pipe_to_ascii(&det, &input, 1, &snk, 1)) >= 0) {
+      if(out_format == F_TEXT)
+        sink_put(&snk, "\n", 1);
+    } else
+#endif
+      dtmf_to_ascii(&det,input,&snk);
+  }
+  sink_flush(&snk);
+  if(out_format == F_TEXT)
+    fputs("Done.\n",output);
+  fflush(output);
+  if(the_replay)
+    replay_report(the_replay);
+  if(tracing)
+    trace_write();
+#ifdef METRICS
+  if(metrics_file)
+    metrics_write();
+#endif
+#ifdef STATS
+  counts_sum(&sum);
+  fprintf(stderr,"frames %ld  gated %ld  screened %ld  full bank %ld  rejected %ld\n",
+          sum.frames, sum.gated, sum.screened, sum.bank, sum.rejected);
+  fprintf(stderr,"events %ld  writes %ld\n", snk.events, snk.writes);
+#endif
+  return(status > 0);          /* events were lost */
+}
@@ -1,59 +1,66 @@
-/*
-<++> dtmf/gen.c
-*/
-
 /* -------- local defines (if we had more.. seperate file) ----- */
-#define FSAMPLE   8000   /* sampling rate, 8KHz */
-
-/*
- * FLOAT_TO_SAMPLE converts a float in the range -1.0 to 1.0 
- * into a format valid to be written out in a sound file
- * or to a sound device 
- */
-#ifdef SIGNED
-#  define FLOAT_TO_SAMPLE(x)    ((char)((x) * 127.0))
-#else
-#  define FLOAT_TO_SAMPLE(x)    ((char)((x + 1.0) * 127.0))
-#endif
-
 /* #define SOUND_DEV  "/dev/dsp" */
 #define SOUND_DEV  "/dev/snd/pcmC0D0p" 
 
 
+#ifdef THREADS
+#define _GNU_SOURCE            /* CPU_SET, see pace_start() */
+#endif
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef THREADS
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <signal.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#endif
 
+#include "synth.h"
+#include "detect.h"         /* now_ns() */
+
+#define BLEN 128
 typedef char sample;
 /* --------------------------------------------------------------- */
 
 #include <fcntl.h>
 
+struct synth synth;
+
+/* Freqs for 0-9, *, # */
+int row[] = {
+  941, 697, 697, 697, 770, 770, 770, 852, 852, 852, 941, 941 };
+int col[] = {
+  1336, 1209, 1336, 1477, 1209, 1336, 1477, 1209, 1336, 1477,
+  1209, 1477 };
+
+/* the dtmf() digit of c, -1 if it is none */
+dtmf_index(int c)
+{
+  if(c >= '0' && c <= '9')
+    return(c - '0');
+  if(c == '*')
+    return(10);
+  if(c == '#')
+    return(11);
+  return(-1);
+}
+
 /*
- * take the sine of x, where x is 0 to 65535 (for 0 to 360 degrees)
+ * write what the synthesizer was asked for
+ * to sound_out
  */
-float mysine(short in)
-{
-  static coef[] = {
-     3.140625, 0.02026367, -5.325196, 0.5446778, 1.800293 };
-  float x,y,res;
-  int sign,i;
- 
-  printf("(%d, ", in);
-  if(in < 0) {       /* force positive */
-    sign = -1;
-    in = -in;
-  } else
-    sign = 1;
-  if(in >= 0x4000)      /* 90 degrees */
-    in = 0x8000 - in;   /* 180 degrees - in */
-  x = in * (1/32768.0); 
-  y = x;               /* y holds x^i) */
-  res = 0;
-  for(i=0; i<5; i++) {
-    res += y * coef[i];
-    y *= x;
-  }
-  printf("%f )", res*sign);
-  return(res * sign); 
+play(int sound_out)
+{
+  sample cout[BLEN];
+  long x;
+
+  while((x = synth_run(&synth, cout, BLEN)) > 0)
+    write(sound_out, cout, x * sizeof(sample));
 }
 
 /*
@@ -63,32 +70,8 @@ float mysine(short in)
  */
 two_tones(int sound_out, unsigned int tone1, unsigned int tone2, unsigned int length)
 {
-#define BLEN 128
-  sample cout[BLEN];
-  float out;
-  unsigned int ad1,ad2;
-  short c1,c2;
-  int i,l,x;
-   
-  ad1 = (tone1 << 16) / FSAMPLE;
-  ad2 = (tone2 << 16) / FSAMPLE;
-  l = (length * FSAMPLE) / 1000;
-  x = 0;
-  printf("<");
-  for( c1=0, c2=0, i=0 ;
-       i < l;
-       i++, c1+= ad1, c2+= ad2 ) {
-    out = (mysine(c1) + mysine(c2)) * 0.5;
-    cout[x++] = FLOAT_TO_SAMPLE(out);
-    if (x==BLEN) {
-      printf("%d ", cout[x-1]);
-      write(sound_out, cout, x * sizeof(sample));
-      x=0;
-    }
-    // printf("\n");
-  }
-  write(sound_out, cout, x);
-  printf("> ");
+  synth_tones(&synth, tone1, tone2, length);
+  play(sound_out);
 }
 
 /*
@@ -97,20 +80,8 @@ two_tones(int sound_out, unsigned int tone1, unsigned int tone2, unsigned int le
  */
 silence(int sound_out, unsigned int length)
 {
-  int l,i,x;
-  static sample c0 = FLOAT_TO_SAMPLE(0.0);
-  sample cout[BLEN];
-
-  x = 0;
-  l = (length * FSAMPLE) / 1000;
-  for(i=0; i < l; i++) {
-    cout[x++] = c0;
-    if (x==BLEN) {
-      write(sound_out, cout, x * sizeof(sample));
-      x=0;
-    }
-  }
-  write(sound_out, cout, x);
+  synth_silence(&synth, length);
+  play(sound_out);
 }
 
 /*
@@ -120,12 +91,6 @@ silence(int sound_out, unsigned int length)
  */
 dtmf(int sound_fd, int digit, int length)
 {
-  /* Freqs for 0-9, *, # */
-  static int row[] = {
-    941, 697, 697, 697, 770, 770, 770, 852, 852, 852, 941, 941 };
-  static int col[] = {
-    1336, 1209, 1336, 1477, 1209, 1336, 1477, 1209, 1336, 1447,
-    1209, 1477 };
   printf("{%d %d} ", row[digit], col[digit]);
   two_tones(sound_fd, row[digit], col[digit], length);
 }
@@ -138,18 +103,10 @@ dtmf(int sound_fd, int digit, int length)
 dial(int sound_fd, char *number)
 {
   int i,x;
-  char c;
 
   printf ("dial ");
   for(i=0;number[i];i++) {
-     c = number[i];
-     x = -1;
-     if(c >= '0' && c <= '9')
-       x = c - '0';
-     else if(c == '*')
-       x = 10;
-     else if(c == '#')
-       x = 11;
+     x = dtmf_index(number[i]);
      if(x >= 0)
      {
        printf("%d ", x);
@@ -160,49 +117,477 @@ dial(int sound_fd, char *number)
   printf("\n");
 }
 
-main()
+/*
+ * bell 202 FSK at 1200 baud, mark (1) 1200 Hz and
+ * space (0) 2200 Hz, for caller ID
+ * outputs the low n bits of 'bits', lsb first, to sound_out.
+ * the phase carries on from one call to the next
+ */
+fsk_bits(int sound_out, unsigned int bits, int n)
 {
-  int sfd;
-  char number[100];
+  synth_fsk(&synth, bits, n);
+  play(sound_out);
+}
 
-  sfd = open(SOUND_DEV,O_RDWR);
-  if(sfd<0) {
-    perror(SOUND_DEV);
-    return(-1);
+/*
+ * a byte with its start and stop bits.  static, the
+ * detector's library has one of its own
+ */
+static fsk_byte(int sound_out, int byte)
+{
+  fsk_bits(sound_out, ((byte & 0xff) << 1) | 0x200, 10);
+}
+
+/*
+ * send a caller ID, as it comes between the first and
+ * second ring: channel seizure, mark, then an MDMF
+ * message with the date and time (now), the number
+ * and, if not 0, the name
+ */
+callerid(int sound_fd, char *number, char *name)
+{
+  unsigned char msg[2+255];
+  char date[16];
+  time_t now;
+  int i,l,sum;
+
+  printf ("caller id ");
+  time(&now);
+  strftime(date, sizeof(date), "%m%d%H%M", localtime(&now));
+  l = 2;
+  msg[l++] = 0x01;                 /* date and time */
+  msg[l++] = 8;
+  memcpy(msg + l, date, 8);
+  l += 8;
+  msg[l++] = 0x02;                 /* number */
+  msg[l++] = strlen(number);
+  memcpy(msg + l, number, strlen(number));
+  l += strlen(number);
+  if(name) {
+    msg[l++] = 0x07;               /* name */
+    msg[l++] = strlen(name);
+    memcpy(msg + l, name, strlen(name));
+    l += strlen(name);
   }
-  printf("Enter fone number: ");
-  fgets(number,98, stdin);
-  dial(sfd,number);
+  msg[0] = 0x80;                   /* MDMF */
+  msg[1] = l - 2;
+  for(i=0, sum=0; i<l; i++)
+    sum += msg[i];
+
+  silence(sound_fd,500);
+  for(i=0; i<300; i++)             /* channel seizure, 0101... */
+    fsk_bits(sound_fd, i & 1, 1);
+  for(i=0; i<180; i++)             /* mark */
+    fsk_bits(sound_fd, 1, 1);
+  for(i=0; i<l; i++)
+    fsk_byte(sound_fd, msg[i]);
+  fsk_byte(sound_fd, -sum);        /* checksum */
+  fsk_bits(sound_fd, 1, 1);
+  silence(sound_fd,500);
+  printf("%s %s %s\n", date, number, name? name: "");
 }
 
+#ifdef THREADS
+/*
+ * paced playout.
+ *
+ *    gen -p list [-f ms] [-t threads] [-r report]
+ *
+ * dials many numbers at once, each to a channel of its
+ * own, in frames of 'ms' (20, or 10) sent when they are
+ * due rather than as fast as write() takes them.  a line
+ * of the list is an output and a number:
+ *
+ *    /tmp/ch1.raw          5551212
+ *    udp:10.0.0.2:4000     18005551212
+ *    rtp:10.0.0.2:5004     411
+ *
+ * a path is a file or a FIFO, udp: sends each frame as a
+ * datagram of samples and rtp: as RTP, PCMU.  the digits
+ * are synthesized as dial() does them, a channel ends
+ * with its last silence.
+ *
+ * there is a pacer thread a CPU (-t sets how many), each
+ * held to its CPU with a timer wheel of WHEEL ms slots.
+ * channel i is the pacer i%threads's and its frames fall
+ * due on the ms (i/threads)%ms of every frame, so a
+ * thousand channels do not all send at once.  a pacer
+ * sleeps to the start of the next ms, sends the frames of
+ * its slot and puts each channel back a frame later.  if
+ * it falls behind the sleeps return at once and it
+ * catches up, the frames are late not lost.  a write
+ * that would block drops the frame.
+ *
+ * how late each frame was sent, from its ms, is summed
+ * up at the end.  -r also writes a line a frame to
+ * 'report': channel, frame and how late in us.
+ */
+#define WHEEL     64          /* slots, of a ms, over the longest frame */
+#define MAXFRAME  60          /* ms */
+#define NLATE     24          /* lateness buckets, 1 us up in powers of 2 */
+#define LOGBUF    65536       /* of -r lines, a pacer's */
+#define DIGIT_MS  50          /* as dial() */
+#define RTP_PCMU  0
+
+struct chan {
+  struct chan *next;       /* in its slot */
+  int n;                   /* line of the list */
+  int fd;
+  int rtp;                 /* frames as RTP, else samples */
+  struct synth s;
+  char *number;            /* what is left of it */
+  int gap;                 /* the silence after a digit comes next */
+  long frame;              /* frames sent */
+  unsigned short seq;      /* RTP */
+  unsigned int ts, ssrc;
+};
+
+struct pacer {
+  pthread_t tid;
+  int cpu;
+  struct chan *wheel[WHEEL];
+  int nchan;               /* still dialing */
+  long frames, dropped;
+  long late_sum, late_max;
+  long hist[NLATE];
+  int nlog;
+  char log[LOGBUF];
+};
+
+int frame_ms = 20;
+long t0;                   /* ns, of tick 0 */
+int report_fd = -1;
+
 /*
-<-->
-<++> dtmf/Makefile
-*/
+ * the next tone or silence of channel cp into its
+ * synthesizer, as dial() would play it
+ *
+ * returns 0 once the number is done
+ */
+next_piece(struct chan *cp)
+{
+  int x;
+
+  while(*cp->number) {
+    if(cp->gap) {
+      synth_silence(&cp->s, DIGIT_MS);
+      cp->gap = 0;
+      cp->number++;
+      return(1);
+    }
+    cp->gap = 1;
+    if((x = dtmf_index(*cp->number)) >= 0) {
+      synth_tones(&cp->s, row[x], col[x], DIGIT_MS);
+      return(1);
+    }
+  }
+  return(0);
+}
+
+/* G.711 mu-law of a 16 bit sample */
+unsigned char ulaw(int x)
+{
+  int sign, exp, mask;
+
+  sign = (x < 0)? 0x80: 0;
+  if(x < 0)
+    x = -x;
+  if(x > 32635)
+    x = 32635;
+  x += 0x84;
+  for(exp=7, mask=0x4000; exp > 0 && !(x & mask); exp--, mask >>= 1)
+    ;
+  return(~(sign | exp << 4 | (x >> (exp + 3) & 0x0f)));
+}
 
 /*
-#
-# Defines:
-#  UNSIGNED  -  use unsigned 8 bit samples
-#               otherwise use signed 8 bit samples
-#
+ * the next frame of channel cp, sent at once
+ *
+ * returns 0 if it was the last, -1 if the last
+ * went before and there was none to send
+ */
+send_frame(struct pacer *pp, struct chan *cp)
+{
+  unsigned char pkt[12 + MAXFRAME * SYNTH_RATE / 1000];
+  char buf[MAXFRAME * SYNTH_RATE / 1000];
+  long n, x, ns = frame_ms * SYNTH_RATE / 1000;
+  int more = 1, i, s;
+
+  for(n=0; n < ns; n += x)
+    if(!(x = synth_run(&cp->s, buf + n, ns - n)) && more &&
+       !(more = next_piece(cp))) {
+      if(!n)
+        return(-1);
+      synth_silence(&cp->s, frame_ms);     /* pad the last frame */
+    }
+  if(cp->rtp) {
+    pkt[0] = 0x80;
+    pkt[1] = RTP_PCMU | (cp->frame? 0: 0x80);     /* marker on the first */
+    pkt[2] = cp->seq >> 8;  pkt[3] = cp->seq;
+    pkt[4] = cp->ts >> 24;  pkt[5] = cp->ts >> 16;
+    pkt[6] = cp->ts >> 8;   pkt[7] = cp->ts;
+    pkt[8] = cp->ssrc >> 24;  pkt[9] = cp->ssrc >> 16;
+    pkt[10] = cp->ssrc >> 8;  pkt[11] = cp->ssrc;
+    for(i=0; i<ns; i++) {
+#ifdef UNSIGNED
+      s = ((unsigned char)buf[i] - 128) << 8;
+#else
+      s = (signed char)buf[i] << 8;
+#endif
+      pkt[12 + i] = ulaw(s);
+    }
+    cp->seq++;
+    cp->ts += ns;
+    x = write(cp->fd, pkt, 12 + ns) - 12;
+  } else
+    x = write(cp->fd, buf, ns);
+  if(x != ns)
+    pp->dropped++;
+  cp->frame++;
+  return(more);
+}
+
+/* the last frame of channel cp was sent 'late' ns after its ms */
+pace_late(struct pacer *pp, struct chan *cp, long late)
+{
+  long us = (late > 0)? late / 1000: 0;
+  int b;
 
-CFLAGS= -DUNSIGNED
+  pp->frames++;
+  pp->late_sum += us;
+  if(us > pp->late_max)
+    pp->late_max = us;
+  for(b=0; us && b<NLATE-1; b++)
+    us >>= 1;
+  pp->hist[b]++;
+  if(report_fd < 0)
+    return(0);
+  pp->nlog += sprintf(pp->log + pp->nlog, "%d %ld %ld\n", cp->n, cp->frame - 1,
+                      (late > 0)? late / 1000: 0);
+  if(pp->nlog > LOGBUF - 64) {
+    write(report_fd, pp->log, pp->nlog);
+    pp->nlog = 0;
+  }
+  return(0);
+}
+
+void *pace(void *arg)
+{
+  struct pacer *pp = (struct pacer *)arg;
+  struct chan *cp, *next, **slot;
+  struct timespec ts;
+  cpu_set_t set;
+  long tick, at;
+  int more;
+
+  CPU_ZERO(&set);
+  CPU_SET(pp->cpu, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  for(tick=0; pp->nchan; tick++) {
+    at = t0 + tick * 1000000L;
+    ts.tv_sec = at / 1000000000L;
+    ts.tv_nsec = at % 1000000000L;
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == EINTR)
+      ;
+    slot = &pp->wheel[tick % WHEEL];
+    cp = *slot;
+    *slot = 0;
+    for(; cp; cp = next) {
+      next = cp->next;
+      if((more = send_frame(pp, cp)) >= 0)
+        pace_late(pp, cp, now_ns() - at);
+      if(more > 0) {
+        slot = &pp->wheel[(tick + frame_ms) % WHEEL];
+        cp->next = *slot;
+        *slot = cp;
+      } else {
+        close(cp->fd);
+        pp->nchan--;
+      }
+    }
+  }
+  if(report_fd >= 0 && pp->nlog)
+    write(report_fd, pp->log, pp->nlog);
+  return(0);
+}
+
+/* the output 'to' of a channel, an fd, or -1 */
+open_out(char *to, int *rtp)
+{
+  struct addrinfo hints, *ai;
+  char host[256], *port;
+  int fd;
+
+  *rtp = !strncmp(to, "rtp:", 4);
+  if(strncmp(to, "udp:", 4) && !*rtp)
+    return(open(to, O_WRONLY|O_CREAT|O_TRUNC|O_NONBLOCK, 0644));
+  strncpy(host, to + 4, sizeof(host) - 1);
+  host[sizeof(host) - 1] = '\0';
+  if(!(port = strrchr(host, ':')))
+    return(-1);
+  *port++ = '\0';
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  if(getaddrinfo(host, port, &hints, &ai))
+    return(-1);
+  fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+  if(fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(ai);
+  if(fd >= 0)
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+  return(fd);
+}
 
-default:	detect gen
+/* dial the channels of 'list' on 'threads' pacers */
+pace_start(char *list, int threads, char *report)
+{
+  struct pacer *pacers, sum;
+  struct chan *cp;
+  char line[512], to[300], number[200];
+  FILE *fp;
+  long frames, c;
+  int i, n, b, started, ncpu = sysconf(_SC_NPROCESSORS_ONLN);
 
-detect: detect.c
-	$(CC) detect.c -o detect
+  if(!(fp = fopen(list, "r"))) {
+    perror(list);
+    return(-1);
+  }
+  if(report &&
+     (report_fd = open(report, O_WRONLY|O_CREAT|O_TRUNC|O_APPEND, 0644)) < 0) {
+    perror(report);
+    fclose(fp);
+    return(-1);
+  }
+  signal(SIGPIPE, SIG_IGN);        /* a FIFO with no reader */
+  if(!(pacers = (struct pacer *)calloc(threads, sizeof(*pacers)))) {
+    perror("pace");
+    fclose(fp);
+    return(-1);
+  }
+  for(i=0; i<threads; i++)
+    pacers[i].cpu = i % ncpu;
+  for(n=0, c=0; fgets(line, sizeof(line), fp); ) {
+    n++;
+    if(sscanf(line, "%299s %199s", to, number) != 2 || to[0] == '#')
+      continue;
+    if(!(cp = (struct chan *)calloc(1, sizeof(*cp)))) {
+      perror("pace");
+      fclose(fp);
+      return(-1);
+    }
+    if((cp->fd = open_out(to, &cp->rtp)) < 0) {
+      fprintf(stderr, "line %d: can not open %s\n", n, to);
+      free(cp);
+      continue;
+    }
+    cp->n = n;
+    cp->number = strdup(number);
+    cp->ssrc = 0x5eed0000 + n;
+    synth_init(&cp->s);
+    i = c % threads;               /* its pacer, and its ms */
+    b = (c / threads) % frame_ms;
+    cp->next = pacers[i].wheel[b];
+    pacers[i].wheel[b] = cp;
+    pacers[i].nchan++;
+    c++;
+  }
+  fclose(fp);
+  printf("pacing %ld channels, %d ms frames, %d threads\n", c, frame_ms,
+         threads);
+  t0 = now_ns() + 10000000L;      /* 10 ms to get going */
+  for(started=0; started<threads; started++)
+    if((errno = pthread_create(&pacers[started].tid, 0, pace,
+                               &pacers[started]))) {
+      perror("pace");
+      break;
+    }
+  memset(&sum, 0, sizeof(sum));
+  for(i=0; i<started; i++) {
+    pthread_join(pacers[i].tid, 0);
+    sum.frames += pacers[i].frames;
+    sum.dropped += pacers[i].dropped;
+    sum.late_sum += pacers[i].late_sum;
+    if(pacers[i].late_max > sum.late_max)
+      sum.late_max = pacers[i].late_max;
+    for(b=0; b<NLATE; b++)
+      sum.hist[b] += pacers[i].hist[b];
+  }
+  printf("frames %ld  dropped %ld  late mean %ld us  max %ld us\n",
+         sum.frames, sum.dropped, sum.frames? sum.late_sum / sum.frames: 0,
+         sum.late_max);
+  for(b=0, frames=0; b<NLATE; b++)
+    if(sum.hist[b]) {
+      frames += sum.hist[b];
+      printf("  late < %7ld us  %ld  (%.3f%%)\n", 1L << b, sum.hist[b],
+             100.0 * frames / sum.frames);
+    }
+  if(report_fd >= 0)
+    close(report_fd);
+  return((started < threads)? -1: 0);
+}
+#endif
 
-gen:	gen.c
-	$(CC) gen.c -o gen
+/*
+ * gen [-c [name]] [file]
+ * dials the number asked for, or with -c sends it
+ * as a caller ID.  to 'file' instead of the sound
+ * device if given.  gen -p paces many channels, see
+ * pace_start().
+ */
+main(int argc, char **argv)
+{
+  int sfd, cid = 0;
+  char number[100], *name = 0, *dev = SOUND_DEV;
+#ifdef THREADS
+  char *list = 0, *report = 0;
+  int threads = sysconf(_SC_NPROCESSORS_ONLN);
 
-clobber: clean
-	rm -rf detect gen 
+  for(; argc > 1 && argv[1][0] == '-' && argv[1][1] &&
+        strchr("pftr", argv[1][1]) && !argv[1][2]; argc -= 2, argv += 2)
+    switch(argc > 2? argv[1][1]: 0) {
+      case 'p': list = argv[2];  break;
+      case 'f': frame_ms = atoi(argv[2]);  break;
+      case 't': threads = atoi(argv[2]);  break;
+      case 'r': report = argv[2];  break;
+      default:  list = "";       /* no value, see below */
+    }
+  if(list) {
+    if(argc > 1 || !*list || frame_ms < 1 || frame_ms > MAXFRAME ||
+       threads < 1) {
+      fprintf(stderr, "usage: gen -p list [-f ms] [-t threads] [-r report]\n");
+      return(-1);
+    }
+    return(pace_start(list, threads, report));
+  }
+#endif
 
-clean:
-	rm -rf *.o core a.out
-<-->
+  if(argc > 1 && !strcmp(argv[1], "-c")) {
+    cid = 1;
+    argc--, argv++;
+    if(argc > 2) {
+      name = argv[1];
+      argc--, argv++;
+    }
+  }
+  if(argc > 1)
+    dev = argv[1];
+  synth_init(&synth);
+  sfd = (dev == SOUND_DEV)? open(dev,O_RDWR):
+                            open(dev,O_WRONLY|O_CREAT|O_TRUNC,0644);
+  if(sfd<0) {
+    perror(dev);
+    return(-1);
+  }
+  printf("Enter fone number: ");
+  fgets(number,98, stdin);
+  number[strcspn(number, "\r\n")] = '\0';
+  if(cid)
+    callerid(sfd,number,name);
+  else
+    dial(sfd,number);
+}
 
-EOF
-*/
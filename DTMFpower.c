@@ -0,0 +1,219 @@
+/*
+ * power.c
+ * read a power dump (detect -P file), to tune RANGE and
+ * THRESH on real input without decoding it again.
+ *
+ *    power [-c chan] [-s] dump
+ *
+ * prints a line a frame: the channel, the frame, its
+ * result, the threshold it was decoded at and the power
+ * of each tone of the classic bank,
+ * lowest first, a block of a channel at a time.  -c keeps
+ * one channel.  -s instead sums it up: the results, how
+ * the loudest tone of the frames falls against the
+ * threshold it was decoded at, and for the frames that
+ * were a tone how near the third strongest came to the
+ * range of the loudest, the margin of the decision.
+ *
+ *    cc -DUNSIGNED power.c -o power libdetect.a -lm
+ *
+ * the dump is mapped and read a column at a time, see
+ * spec_frame() for its layout.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "detect.h"
+
+#define NOCT  12        /* octaves of the loudest tone, about the threshold */
+#define NMARGIN 10      /* tenths of the loudest */
+
+/* the name of result x */
+char *result_name(x, buf)
+int x;
+char *buf;
+{
+  char *p, *q;
+
+  if(x == DSIL)
+    return(".");
+  if(x < 0 || x > VCID)
+    return("?");
+  for(p=dtran[x]; *p == ' ' || *p == '+'; p++)
+    ;
+  strcpy(buf, p);
+  for(q=buf+strlen(buf); q > buf && (q[-1] == ' ' || q[-1] == '+'); )
+    *--q = '\0';
+  return(buf);
+}
+
+/* print the frames of block sp */
+print_block(h, sp)
+struct spec_head *h;
+struct spec *sp;
+{
+  char buf[32];
+  int f,i;
+
+  for(f=0; f<sp->nframes; f++) {
+    printf("%d %lld %s %.4g", sp->chan, sp->first + f,
+           result_name(sp->result[f], buf), sp->thresh[f]);
+    for(i=0; i<h->ntones; i++)
+      printf(" %.4g", sp->power[i][f]);
+    putchar('\n');
+  }
+  return(0);
+}
+
+long results[VCID+3];   /* by result+1, the last any other */
+long oct[NOCT];         /* frames by loudest tone, octaves from threshold/64 */
+long margin[NMARGIN+1]; /* tone frames by third/loudest, in tenths */
+float range[2];         /* the least and most of the blocks' */
+
+/* add block sp to the sums */
+sum_block(h, sp)
+struct spec_head *h;
+struct spec *sp;
+{
+  float p[3], v, top[SPEC_BLOCK];
+  int f,i,b;
+
+  if(!range[1] || sp->range < range[0])
+    range[0] = sp->range;
+  if(sp->range > range[1])
+    range[1] = sp->range;
+  for(f=0; f<sp->nframes; f++)
+    top[f] = 0.0;
+  for(i=0; i<h->ntones; i++)       /* a column at a time */
+    for(f=0; f<sp->nframes; f++)
+      if(sp->power[i][f] > top[f])
+        top[f] = sp->power[i][f];
+  for(f=0; f<sp->nframes; f++) {
+    i = sp->result[f];
+    results[(i >= -1 && i <= VCID)? i+1: VCID+2]++;
+    for(b=0, v=sp->thresh[f]/64; b<NOCT-1 && top[f] >= v; b++)
+      v *= 2;
+    oct[b]++;
+    if(i < 0 || i == DSIL)
+      continue;
+    p[0] = p[1] = p[2] = 0.0;
+    for(i=0; i<h->ntones; i++) {
+      v = sp->power[i][f];
+      if(v > p[0]) {
+        p[2] = p[1];  p[1] = p[0];  p[0] = v;
+      } else if(v > p[1]) {
+        p[2] = p[1];  p[1] = v;
+      } else if(v > p[2])
+        p[2] = v;
+    }
+    b = (p[0] > 0.0)? (int)(p[2] / p[0] * NMARGIN): 0;
+    margin[(b > NMARGIN)? NMARGIN: b]++;
+  }
+  return(0);
+}
+
+print_sums(h)
+struct spec_head *h;
+{
+  char buf[32];
+  double v;
+  int i;
+
+  printf("results\n");
+  for(i=0; i<VCID+3; i++)
+    if(results[i])
+      printf("  %-12s %ld\n", (i == VCID+2)? "other": result_name(i-1, buf),
+             results[i]);
+  printf("loudest tone / the frame's threshold\n");
+  for(i=0, v=1/64.0; i<NOCT; i++, v *= 2)
+    printf("  %s %-10g %ld\n", (i < NOCT-1)? "< ": ">=",
+           (i < NOCT-1)? v: v/2, oct[i]);
+  if(range[0] == range[1])
+    printf("third tone / loudest  (range %g), tones only\n", range[0]);
+  else
+    printf("third tone / loudest  (range %g to %g), tones only\n",
+           range[0], range[1]);
+  for(i=0; i<=NMARGIN; i++)
+    printf("  %s %.1f  %ld\n", (i < NMARGIN)? "< ": ">=",
+           (i < NMARGIN)? (i+1.0)/NMARGIN: 1.0, margin[i]);
+  return(0);
+}
+
+usage(prog)
+char *prog;
+{
+  fprintf(stderr,"usage:  %s [-c chan] [-s] dump\n",prog);
+  fprintf(stderr,"  -c chan     only this channel\n");
+  fprintf(stderr,"  -s          sums, not the frames\n");
+  return(-1);
+}
+
+main(argc,argv)
+int argc;
+char **argv;
+{
+  struct spec_head *h;
+  struct spec *sp;
+  struct stat st;
+  char *prog = argv[0], *map;
+  int fd, chan = -2, sums = 0;
+  long nblock, b;
+
+  for(; argc > 1 && argv[1][0] == '-' && argv[1][1]; argc--, argv++) {
+    if(!strcmp(argv[1], "-s"))
+      sums = 1;
+    else if(!strcmp(argv[1], "-c") && argc > 2) {
+      chan = atoi(argv[2]);
+      argc--;
+      argv++;
+    } else
+      return(usage(prog));
+  }
+  if(argc != 2)
+    return(usage(prog));
+  if((fd = open(argv[1], O_RDONLY)) < 0) {
+    perror(argv[1]);
+    return(-1);
+  }
+  if(fstat(fd, &st) < 0 || st.st_size < sizeof(*h) ||
+     (map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    fprintf(stderr, "%s: can not map it\n", argv[1]);
+    close(fd);
+    return(-1);
+  }
+  close(fd);
+  h = (struct spec_head *)map;
+  if(memcmp(h->magic, "DTPW", 4) || h->version != SPEC_VERSION ||
+     h->ntones != NUMTONES || h->block != SPEC_BLOCK) {
+    fprintf(stderr, "%s: not a power dump of this detector\n", argv[1]);
+    return(-1);
+  }
+  nblock = (st.st_size - sizeof(*h)) / SPEC_SIZE;
+  if(!sums) {
+    printf("# chan frame result thresh");
+    for(b=0; b<h->ntones; b++)
+      printf(" %.0f", (double)h->k[b] * h->fsample / h->n);
+    putchar('\n');
+  }
+  for(b=0; b<nblock; b++) {
+    sp = (struct spec *)(map + sizeof(*h) + b * SPEC_SIZE);
+    if(sp->nframes < 0 || sp->nframes > SPEC_BLOCK) {
+      fprintf(stderr, "%s: block %ld is damaged, skipped\n", argv[1], b);
+      continue;
+    }
+    if(chan != -2 && sp->chan != chan)
+      continue;
+    if(sums)
+      sum_block(h, sp);
+    else
+      print_block(h, sp);
+  }
+  if(sums)
+    print_sums(h);
+  return(0);
+}
@@ -0,0 +1,474 @@
+/*
+ * query.c
+ * answer questions about an archive from the event
+ * index a scan left (detect -x index -s ...), without
+ * decoding any audio.
+ *
+ *    query [-u] [-v] [-d detect] index pattern...
+ *
+ * prints every run of digits in a file that matches a
+ * pattern, with its first and last second:
+ *
+ *    /calls/0412.u8  12.360  13.740  911
+ *
+ * a pattern is digits (0-9 * # A-D) and MF signals (KP
+ * for KP1 or KP2, KP1, KP2, ST, C11, C12), '?' for any
+ * one of them and '...' for any run, so "911" or
+ * "KP...ST".  only digits and signals are searched, the
+ * other tones of a call do not split a run.
+ *
+ * a file whose size, mtime or detector key is not the
+ * one indexed is stale, its events may not be what the
+ * file holds now.  stale files are named on stderr, -v
+ * also checks the contents against the indexed hash.
+ * -u first rebuilds the stale entries, running the
+ * detector (-d, "DTMFdetect" by default) over just
+ * those files, with the options the index was made
+ * with (and -X, as -v may find files stale that look
+ * the same to it).
+ *
+ *    cc  query.c -o query
+ *
+ * the index layout is detect.c's (see ix_save), kept
+ * here in step with it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define FSAMPLE  8000
+#define IX_VERSION  2
+
+struct ix_head {
+  char magic[4];          /* DTIX */
+  int version;            /* IX_VERSION */
+  int detector;           /* DET_VERSION of the writer */
+  unsigned key;           /* of the writer's detector and options */
+  char opts[128];         /* the writer's options, for a rebuild */
+  int nfiles;
+  int pad;
+  long long nevents;
+  long long names;        /* offset of the names */
+};
+
+struct ix_file {
+  long long size, mtime;
+  unsigned long long hash;
+  long long first;        /* its first record */
+  int nevents;
+  unsigned key;
+  long long name;         /* offset of its name */
+};
+
+struct record {
+  int chan;
+  int code;
+  long long start, end;
+  float peak[2];
+};
+
+/* the codes searched, detect.c's D0 to DST */
+#define NCODES  21
+#define DKP1    18
+#define DKP2    19
+char *qtran[NCODES] = {
+  "0", "1", "2", "3", "4", "5", "6", "7", "8", "9",
+  "*", "#", "A", "B", "C", "D",
+  "+C11", "+C12", "KP1+", "KP2+", "+ST" };
+
+/* pattern items past the codes */
+#define Q_ANY   NCODES          /* ? */
+#define Q_RUN   (NCODES+1)      /* ... */
+#define Q_KP    (NCODES+2)      /* KP1 or KP2 */
+
+struct index {
+  struct ix_head *head;
+  long len;
+  struct ix_file *files;
+  struct record *rec;
+  char *names;
+};
+
+/*
+ * does the index of 'len' bytes at h hold together: the
+ * files table, the records and the names inside it, and
+ * each file's events and name inside them
+ */
+ix_sound(h, len)
+struct ix_head *h;
+long len;
+{
+  struct ix_file *files = (struct ix_file *)(h + 1);
+  long long left = len - (long long)sizeof(*h), nnames;
+  char *names;
+  int f;
+
+  if(h->nfiles < 0 || h->nevents < 0 ||
+     h->nfiles > left / (long long)sizeof(struct ix_file))
+    return(0);
+  left -= h->nfiles * (long long)sizeof(struct ix_file);
+  if(h->nevents > left / (long long)sizeof(struct record))
+    return(0);
+  left -= h->nevents * (long long)sizeof(struct record);
+  if(h->names != len - left)
+    return(0);
+  names = (char *)h + h->names;
+  nnames = left;
+  for(f=0; f<h->nfiles; f++)
+    if(files[f].first < 0 || files[f].nevents < 0 ||
+       files[f].first > h->nevents - files[f].nevents ||
+       files[f].name < 0 || files[f].name >= nnames ||
+       !memchr(names + files[f].name, 0, nnames - files[f].name))
+      return(0);
+  return(1);
+}
+
+/* map the index at path, 0 if it is not one */
+ix_map(ix, path)
+struct index *ix;
+char *path;
+{
+  struct stat st;
+  void *map;
+  int fd;
+
+  if((fd = open(path, O_RDONLY)) < 0) {
+    perror(path);
+    return(0);
+  }
+  if(fstat(fd, &st) < 0 || st.st_size < sizeof(struct ix_head) ||
+     (map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    fprintf(stderr, "%s: can not map it\n", path);
+    close(fd);
+    return(0);
+  }
+  close(fd);
+  ix->head = (struct ix_head *)map;
+  ix->len = st.st_size;
+  if(memcmp(ix->head->magic, "DTIX", 4) ||
+     ix->head->version != IX_VERSION) {
+    fprintf(stderr, "%s: not an index\n", path);
+    munmap(map, st.st_size);
+    return(0);
+  }
+  if(!ix_sound(ix->head, ix->len)) {
+    fprintf(stderr, "%s: a damaged index, or cut short\n", path);
+    munmap(map, st.st_size);
+    return(0);
+  }
+  ix->files = (struct ix_file *)(ix->head + 1);
+  ix->rec = (struct record *)(ix->files + ix->head->nfiles);
+  ix->names = (char *)map + ix->head->names;
+  return(1);
+}
+
+/* FNV-1a, 64 bit, the same as detect.c's */
+unsigned long long fnv(h, p, n)
+unsigned long long h;
+unsigned char *p;
+long n;
+{
+  while(n-- > 0)
+    h = (h ^ *p++) * 0x100000001b3ULL;
+  return(h);
+}
+
+/* the hash of the contents of 'name', 0 if unreadable */
+unsigned long long file_hash(name)
+char *name;
+{
+  unsigned long long h = 0xcbf29ce484222325ULL;
+  static char buf[1 << 16];
+  int fd, n;
+
+  if((fd = open(name, O_RDONLY)) < 0)
+    return(0);
+  while((n = read(fd, buf, sizeof(buf))) > 0)
+    h = fnv(h, buf, (long)n);
+  close(fd);
+  return(h);
+}
+
+/* 1 if file f is not as it was indexed */
+stale(ix, f, verify)
+struct index *ix;
+int f, verify;
+{
+  struct ix_file *fp = &ix->files[f];
+  char *name = ix->names + fp->name;
+  struct stat st;
+
+  if(stat(name, &st) < 0 || st.st_size != fp->size ||
+     st.st_mtime != fp->mtime || fp->key != ix->head->key)
+    return(1);
+  return(verify && file_hash(name) != fp->hash);
+}
+
+/*
+ * the detector's arguments for a rebuild from the options
+ * the index was made with, "-p profile [-c] [-L levels]"
+ * as detect.c's ix_open writes them, into av with
+ * 'opts' split in place.  0 if they are not those
+ */
+rebuild_args(opts, av, detect, path)
+char *opts, **av, *detect, *path;
+{
+  char *w[8];
+  int n = 0, i = 0, k = 0;
+
+  if(!memchr(opts, 0, sizeof(((struct ix_head *)0)->opts)))
+    return(0);
+  for(; *opts && n < 8; n++) {
+    w[n] = opts;
+    if((opts = strchr(opts, ' ')))
+      *opts++ = 0;
+    else
+      opts = w[n] + strlen(w[n]);
+  }
+  av[k++] = detect;
+  if(i+1 < n && !strcmp(w[i], "-p")) {
+    av[k++] = w[i++];
+    av[k++] = w[i++];
+  } else
+    return(0);
+  if(i < n && !strcmp(w[i], "-c"))
+    av[k++] = w[i++];
+  if(i+1 < n && !strcmp(w[i], "-L")) {
+    av[k++] = w[i++];
+    av[k++] = w[i++];
+  }
+  if(i != n || *opts)
+    return(0);
+  av[k++] = "-X";
+  av[k++] = path;
+  av[k] = 0;
+  return(1);
+}
+
+/*
+ * rebuild the stale files of the index at path with
+ * the detector, 1 if there were any.  the detector is
+ * run directly, not through a shell, with the names of
+ * the stale files on its stdin
+ */
+rebuild(ix, path, detect, verify)
+struct index *ix;
+char *path, *detect;
+int verify;
+{
+  char opts[sizeof(ix->head->opts)], *av[12];
+  FILE *fp = 0;
+  int f, p[2], status;
+  pid_t pid;
+
+  for(f=0; f<ix->head->nfiles; f++) {
+    if(!stale(ix, f, verify))
+      continue;
+    if(!fp) {
+      memcpy(opts, ix->head->opts, sizeof(opts));
+      if(!rebuild_args(opts, av, detect, path)) {
+        fprintf(stderr, "%s: not the options of an index\n", path);
+        return(0);
+      }
+      signal(SIGPIPE, SIG_IGN);      /* if it fails to start */
+      if(pipe(p) < 0 || (pid = fork()) < 0) {
+        perror(detect);
+        return(0);
+      }
+      if(!pid) {
+        dup2(p[0], 0);
+        close(p[0]);
+        close(p[1]);
+        execvp(detect, av);
+        perror(detect);
+        _exit(127);
+      }
+      close(p[0]);
+      if(!(fp = fdopen(p[1], "w"))) {
+        perror(detect);
+        close(p[1]);
+        waitpid(pid, &status, 0);
+        return(0);
+      }
+    }
+    fprintf(fp, "%s\n", ix->names + ix->files[f].name);
+  }
+  if(!fp)
+    return(0);
+  fclose(fp);
+  if(waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+     WEXITSTATUS(status))
+    fprintf(stderr, "%s failed\n", detect);
+  return(1);
+}
+
+/*
+ * a pattern into items, n of them at most.
+ * returns the number, -1 if it is not one
+ */
+compile(s, q, n)
+char *s;
+int *q, n;
+{
+  static char *mf[] = { "KP1", "KP2", "ST", "C11", "C12", "KP", 0 };
+  static int mfcode[] = { DKP1, DKP2, 20, 16, 17, Q_KP };
+  char *d = "0123456789*#ABCD", *p;
+  int i, k;
+
+  for(i=0; *s; ) {
+    if(*s == ' ') {
+      s++;
+      continue;
+    }
+    if(i == n)
+      return(-1);
+    if(!strncmp(s, "...", 3)) {
+      q[i++] = Q_RUN;
+      s += 3;
+    } else if(*s == '?') {
+      q[i++] = Q_ANY;
+      s++;
+    } else {
+      for(k=0; mf[k] && strncmp(s, mf[k], strlen(mf[k])); k++)
+        ;
+      if(mf[k]) {
+        q[i++] = mfcode[k];
+        s += strlen(mf[k]);
+      } else if(*s && (p = strchr(d, *s))) {
+        q[i++] = p - d;
+        s++;
+      } else
+        return(-1);
+    }
+  }
+  return(i);
+}
+
+/* does item q take code c */
+one(q, c)
+int q, c;
+{
+  return(q == c || q == Q_ANY || (q == Q_KP && (c == DKP1 || c == DKP2)));
+}
+
+/*
+ * match items q[0..nq-1] from c[0], the shortest way
+ * '...' can.  returns the number of codes, -1 for none
+ */
+match(q, nq, c, n)
+int *q, nq, *c, n;
+{
+  int k, m;
+
+  if(!nq)
+    return(0);
+  if(q[0] == Q_RUN) {
+    for(k=0; k<=n; k++)
+      if((m = match(q+1, nq-1, c+k, n-k)) >= 0)
+        return(k + m);
+    return(-1);
+  }
+  if(!n || !one(q[0], c[0]))
+    return(-1);
+  m = match(q+1, nq-1, c+1, n-1);
+  return((m < 0)? -1: m + 1);
+}
+
+/* print the matches of q in file f */
+search(ix, f, q, nq)
+struct index *ix;
+int f, *q, nq;
+{
+  struct ix_file *fp = &ix->files[f];
+  struct record *r = ix->rec + fp->first, *a, *b;
+  static int *c, *at, size;
+  int i, j, n, m, found = 0;
+
+  if(fp->nevents > size) {
+    size = fp->nevents;
+    c = (int *)realloc(c, size * sizeof(int));
+    at = (int *)realloc(at, size * sizeof(int));
+  }
+  for(i=0, n=0; i<fp->nevents; i++)
+    if(r[i].code >= 0 && r[i].code < NCODES) {
+      c[n] = r[i].code;
+      at[n++] = i;
+    }
+  for(i=0; i<n; ) {
+    if((m = match(q, nq, c+i, n-i)) <= 0) {
+      i++;
+      continue;
+    }
+    a = &r[at[i]];
+    b = &r[at[i+m-1]];
+    printf("%s  %.3f  %.3f  ", ix->names + fp->name,
+           (double)a->start / FSAMPLE, (double)b->end / FSAMPLE);
+    for(j=i; j<i+m; j++)
+      fputs(qtran[c[j]], stdout);
+    putchar('\n');
+    found++;
+    i += m;
+  }
+  return(found);
+}
+
+usage(prog)
+char *prog;
+{
+  fprintf(stderr,"usage:  %s [-u] [-v] [-d detect] index pattern...\n",prog);
+  fprintf(stderr,"  -u          rebuild stale entries first\n");
+  fprintf(stderr,"  -v          check the contents of the files too\n");
+  fprintf(stderr,"  -d detect   the detector, for -u\n");
+  return(-1);
+}
+
+main(argc,argv)
+int argc;
+char **argv;
+{
+  struct index ix;
+  char *prog = argv[0], *detect = "DTMFdetect";
+  int update = 0, verify = 0, q[64], nq, f, a, found = 0;
+
+  for(; argc > 1 && argv[1][0] == '-' && argv[1][1]; argc--, argv++) {
+    if(!strcmp(argv[1], "-u"))
+      update = 1;
+    else if(!strcmp(argv[1], "-v"))
+      verify = 1;
+    else if(!strcmp(argv[1], "-d") && argc > 2) {
+      detect = argv[2];
+      argc--;
+      argv++;
+    } else
+      return(usage(prog));
+  }
+  if(argc < 3)
+    return(usage(prog));
+  if(!ix_map(&ix, argv[1]))
+    return(-1);
+  if(update && rebuild(&ix, argv[1], detect, verify)) {
+    munmap(ix.head, ix.len);
+    if(!ix_map(&ix, argv[1]))
+      return(-1);
+  }
+  for(f=0; f<ix.head->nfiles; f++)
+    if(stale(&ix, f, verify))
+      fprintf(stderr, "stale: %s\n", ix.names + ix.files[f].name);
+
+  for(a=2; a<argc; a++) {
+    if((nq = compile(argv[a], q, 64)) <= 0) {
+      fprintf(stderr, "%s: not a pattern\n", argv[a]);
+      return(usage(prog));
+    }
+    for(f=0; f<ix.head->nfiles; f++)
+      found += search(&ix, f, q, nq);
+  }
+  return(found? 0: 1);
+}
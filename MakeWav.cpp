@@ -53,13 +53,57 @@ The "data" subchunk contains the size of the data and the actual sound:
 
 /* Handshake tone for 0.1s @1400 Hz, 0.1s silence, 0.1s @ 2300Hz all at 8000 samples/s of 8 bits each; 2400 samples of 8 bits */
 
+/*
+ * With no arguments MakeWav writes HandshakeTone.wav and
+ * KissofTone.wav, as it always has.  Given a manifest it
+ * writes a corpus, a file a line, on a pool of threads:
+ *
+ *    MakeWav [-j threads] [-d dir] manifest
+ *
+ * a line of the manifest (- for stdin) is a file name, a
+ * sequence and name=value parameters, or a comment if it
+ * starts with #:
+ *
+ *    hs.wav    1400/100,/100,2300/100
+ *    d1.wav    5551212           level=-20 twist=4 noise=-40
+ *    d2.wav    0123456789*#ABCD  on=40 off=40 jitter=5 bits=16
+ *
+ * the sequence is pieces separated by commas.  f/ms is
+ * a tone of f Hz, f+g/ms two tones, /ms silence, and a
+ * piece without a / is DTMF keys (0-9 * # A-D), each its
+ * two tones for 'on' ms then 'off' ms of silence.
+ *
+ *    level=dB   peak of each tone, dB of full scale (-10)
+ *    twist=dB   of a DTMF row over its column (0)
+ *    noise=dB   rms of white noise over it all (none)
+ *    jitter=ms  each duration up to this much longer or shorter (0)
+ *    on=ms off=ms  of a key (50, 50)
+ *    rate=Hz bits=8|16  of the file (8000, 8)
+ *    seed=n     of the noise and the jitter (the line number)
+ *
+ * every file is rendered from its line alone, so a corpus
+ * is the same whatever -j.  the length is known before a
+ * sample is made, so the file is allocated whole up front
+ * and written WAV_CHUNK at a time with pwrite.  -j is the
+ * number of CPUs by default.
+ *
+ *    c++ -O2 MakeWav.cpp -o MakeWav -lpthread
+ */
+
 //#include <stdio.h>
 //#include <stdlib.h>
 //#include <math.h>
 #include <iostream>
 #include <fstream>
 #include <cstdlib>
+#include <cstdio>
+#include <cstring>
 #include <cmath>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 union utag {
 struct tagWaveFileHeader {
@@ -104,7 +148,8 @@ struct tagWaveFileHeader {
   
                   
 
-int main()
+/* the two tones of the contact id handshake and kissoff */
+static int classic()
 {
   //FILE *fp = fopen("HandshakeTone.wav", "w+b");
   int i,j;
@@ -239,5 +284,349 @@ int main()
   return 0;
 }
 
+#define WAV_CHUNK  (1 << 20)   /* bytes a write */
+#define MAXPIECES  1024        /* of a sequence, keys counted one by one */
+
+/* a piece of a sequence, as it will be rendered */
+struct piece {
+  double f[2];                 /* Hz, 0 for none */
+  double a[2];                 /* peak amplitude of each */
+  long n;                      /* samples */
+};
+
+/* a file to make, a line of the manifest */
+struct job {
+  int line;
+  std::string name, seq, params;
+};
+
+struct pool {
+  std::vector<job> jobs;
+  std::string dir;
+  long next;                   /* job to take */
+  long files, bytes, failed;   /* made so far */
+};
+
+/* xorshift64*, a job's own so the output does not depend on the threads */
+static double uniform(unsigned long long *s)
+{
+  *s ^= *s >> 12;
+  *s ^= *s << 25;
+  *s ^= *s >> 27;
+  return (double)((*s * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+static double gauss(unsigned long long *s)
+{
+  double u = uniform(s);
+
+  if (u < 1e-300)
+    u = 1e-300;
+  return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * uniform(s));
+}
+
+/* the row and column of a DTMF key, 0 if it is not one */
+static int dtmf_key(int c, double *f)
+{
+  static const char keys[] = "123A456B789C*0#D";
+  static const double row[] = { 697, 770, 852, 941 };
+  static const double col[] = { 1209, 1336, 1477, 1633 };
+  const char *p;
+
+  if (!c || !(p = strchr(keys, c)))
+    return 0;
+  f[0] = row[(p - keys) / 4];
+  f[1] = col[(p - keys) % 4];
+  return 1;
+}
+
+/* parameters of a job, see the top of the file */
+struct params {
+  double level, twist, noise, jitter, on, off;
+  int rate, bits;
+  unsigned long long seed;
+};
+
+static int get_params(job *jp, params *pp)
+{
+  const char *names[] = { "level", "twist", "noise", "jitter", "on", "off",
+                          "rate", "bits", "seed", 0 };
+  double v[9];
+  const char *s = jp->params.c_str();
+  char *end;
+  int i, n;
+
+  v[0] = -10;  v[1] = 0;  v[2] = -1000;  v[3] = 0;  v[4] = 50;  v[5] = 50;
+  v[6] = 8000;  v[7] = 8;  v[8] = jp->line;
+  while (*s) {
+    for (; *s == ' ' || *s == '\t'; s++)
+      ;
+    if (!*s)
+      break;
+    for (i = 0; names[i]; i++) {
+      n = strlen(names[i]);
+      if (!strncmp(s, names[i], n) && s[n] == '=')
+        break;
+    }
+    if (!names[i])
+      return -1;
+    v[i] = strtod(s + n + 1, &end);
+    if (end == s + n + 1 || (*end && *end != ' ' && *end != '\t'))
+      return -1;
+    s = end;
+  }
+  pp->level = v[0];  pp->twist = v[1];  pp->noise = v[2];
+  pp->jitter = v[3];  pp->on = v[4];  pp->off = v[5];
+  pp->rate = (int)v[6];  pp->bits = (int)v[7];
+  pp->seed = (unsigned long long)v[8] * 0x9e3779b97f4a7c15ULL + 1;
+  if (pp->rate < 4000 || pp->rate > 192000 || (pp->bits != 8 && pp->bits != 16) ||
+      pp->on < 0 || pp->off < 0 || pp->jitter < 0)
+    return -1;
+  return 0;
+}
+
+/* ms of a piece in samples, jittered */
+static long samples(double ms, params *pp)
+{
+  if (pp->jitter > 0)
+    ms += (2 * uniform(&pp->seed) - 1) * pp->jitter;
+  return (ms > 0) ? (long)(ms * pp->rate / 1000 + 0.5) : 0;
+}
+
+/*
+ * the pieces of the sequence of jp into pc
+ *
+ * returns how many, or -1 if the sequence is bad
+ */
+static int get_pieces(job *jp, params *pp, piece *pc)
+{
+  const char *s = jp->seq.c_str(), *e;
+  double a = pow(10.0, pp->level / 20), f[2], ms;
+  char *end;
+  int n = 0, i;
+
+  for (; *s; s = *e ? e + 1 : e) {
+    for (e = s; *e && *e != ','; e++)
+      ;
+    if (memchr(s, '/', e - s)) {          /* a tone or silence */
+      if (n + 1 > MAXPIECES)
+        return -1;
+      pc[n].f[0] = pc[n].f[1] = 0;
+      for (i = 0; i < 2 && *s != '/'; i++) {
+        pc[n].f[i] = strtod(s, &end);
+        if (end == s || pc[n].f[i] <= 0 || (*end != '/' && (*end != '+' || i)))
+          return -1;
+        if (*(s = end) == '+' && *++s == '/')
+          return -1;
+      }
+      ms = strtod(s + 1, &end);
+      if (end == s + 1 || end != e || ms < 0)
+        return -1;
+      pc[n].a[0] = pc[n].a[1] = a;
+      pc[n++].n = samples(ms, pp);
+      continue;
+    }
+    for (; s < e; s++, n += 2) {          /* keys */
+      if (n + 2 > MAXPIECES || !dtmf_key(*s, f))
+        return -1;
+      pc[n].f[0] = f[0];
+      pc[n].f[1] = f[1];
+      pc[n].a[0] = a;
+      pc[n].a[1] = a * pow(10.0, -pp->twist / 20);
+      pc[n].n = samples(pp->on, pp);
+      pc[n+1].f[0] = pc[n+1].f[1] = 0;
+      pc[n+1].n = samples(pp->off, pp);
+    }
+  }
+  return n;
+}
+
+/*
+ * make the file of job jp, buf is the thread's
+ *
+ * returns its size, -1 if it could not be made
+ */
+static long render(pool *pl, job *jp, char *buf)
+{
+  std::vector<piece> pc(MAXPIECES);
+  params pr;
+  union utag h = unWaveFileHeader;
+  std::string path = pl->dir.empty() ? jp->name : pl->dir + "/" + jp->name;
+  double ph[2], d[2], sigma, v;
+  long total, off, i, left, n;
+  int np, p, fd, size, ok;
+
+  if (get_params(jp, &pr) < 0 || (np = get_pieces(jp, &pr, &pc[0])) < 0) {
+    std::cerr << "line " << jp->line << ": bad sequence or parameters\n";
+    return -1;
+  }
+  size = pr.bits / 8;
+  for (p = 0, total = 0; p < np; p++)
+    total += pc[p].n;
+  h.stWaveFileHeader.sampleRate = pr.rate;
+  h.stWaveFileHeader.bitsPerSample = pr.bits;
+  h.stWaveFileHeader.blockAlign = size;
+  h.stWaveFileHeader.byteRate = pr.rate * size;
+  h.stWaveFileHeader.subChunk2Size = total * size;
+  h.stWaveFileHeader.chunkSize = 36 + total * size;
+
+  if ((fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+    perror(path.c_str());
+    return -1;
+  }
+  /* all of it at once, so the blocks are together; not every file system can */
+  if (posix_fallocate(fd, 0, sizeof(h) + total * size) != 0 &&
+      ftruncate(fd, sizeof(h) + total * size) < 0) {
+    perror(path.c_str());
+    close(fd);
+    return -1;
+  }
+  memcpy(buf, h.cWFH, sizeof(h));
+  sigma = (pr.noise > -1000) ? pow(10.0, pr.noise / 20) : 0;
+  off = 0;
+  n = sizeof(h);
+  for (p = 0; p < np; p++) {
+    for (i = 0; i < 2; i++) {
+      ph[i] = 0;
+      d[i] = 2 * M_PI * pc[p].f[i] / pr.rate;
+    }
+    for (left = pc[p].n; left > 0; left--) {
+      v = 0;
+      for (i = 0; i < 2; i++)
+        if (pc[p].f[i] > 0) {
+          v += pc[p].a[i] * sin(ph[i]);
+          ph[i] += d[i];
+        }
+      if (sigma > 0)
+        v += sigma * gauss(&pr.seed);
+      v = (v > 1) ? 1 : (v < -1) ? -1 : v;
+      if (size == 1)
+        buf[n++] = (unsigned char)round((v + 1.0) * 127.5);
+      else {
+        short s16 = (short)round(v * 32767);
+        memcpy(buf + n, &s16, 2);
+        n += 2;
+      }
+      if (n == WAV_CHUNK) {
+        if (pwrite(fd, buf, n, off) != n)
+          break;
+        off += n;
+        n = 0;
+      }
+    }
+    if (left > 0)
+      break;
+  }
+  ok = p == np && (!n || pwrite(fd, buf, n, off) == n);
+  if (close(fd) < 0 || !ok) {
+    perror(path.c_str());
+    return -1;
+  }
+  return off + n;
+}
+
+static void *worker(void *arg)
+{
+  pool *pl = (pool *)arg;
+  char *buf = new char[WAV_CHUNK];
+  long j, size;
+
+  while ((j = __sync_fetch_and_add(&pl->next, 1)) < (long)pl->jobs.size()) {
+    size = render(pl, &pl->jobs[j], buf);
+    if (size < 0)
+      __sync_fetch_and_add(&pl->failed, 1);
+    else {
+      __sync_fetch_and_add(&pl->files, 1);
+      __sync_fetch_and_add(&pl->bytes, size);
+    }
+  }
+  delete[] buf;
+  return 0;
+}
+
+/* the lines of the manifest 'name' into pl, -1 if it can not be read */
+static int read_manifest(const char *name, pool *pl)
+{
+  std::ifstream file;
+  std::istream *in = &std::cin;
+  std::string s, w[2];
+  size_t p, q;
+  int line, i;
+
+  if (strcmp(name, "-")) {
+    file.open(name);
+    if (!file) {
+      std::cerr << "can not read " << name << "\n";
+      return -1;
+    }
+    in = &file;
+  }
+  for (line = 1; std::getline(*in, s); line++) {
+    for (i = 0, p = 0; i < 2; i++) {
+      p = s.find_first_not_of(" \t\r", p);
+      q = (p == std::string::npos) ? p : s.find_first_of(" \t\r", p);
+      w[i] = (p == std::string::npos) ? "" : s.substr(p, q - p);
+      p = q;
+    }
+    if (w[0].empty() || w[0][0] == '#')
+      continue;
+    if (w[1].empty()) {
+      std::cerr << "line " << line << ": no sequence\n";
+      return -1;
+    }
+    job j;
+    j.line = line;
+    j.name = w[0];
+    j.seq = w[1];
+    j.params = (p == std::string::npos) ? "" : s.substr(p);
+    pl->jobs.push_back(j);
+  }
+  return 0;
+}
 
+static int usage(const char *prog)
+{
+  std::cerr << "usage:  " << prog << " [-j threads] [-d dir] [manifest]\n";
+  std::cerr << "  -j threads  files made at once, the CPUs by default\n";
+  std::cerr << "  -d dir      where the files go\n";
+  std::cerr << "  no manifest, the handshake and kissoff tones\n";
+  return -1;
+}
 
+int main(int argc, char **argv)
+{
+  const char *prog = argv[0];
+  std::vector<pthread_t> tid;
+  pool pl;
+  long nthreads = sysconf(_SC_NPROCESSORS_ONLN), t;
+
+  for (; argc > 1 && argv[1][0] == '-' && argv[1][1]; argc--, argv++) {
+    if (!strcmp(argv[1], "-j") && argc > 2)
+      nthreads = atoi(argv[2]);
+    else if (!strcmp(argv[1], "-d") && argc > 2)
+      pl.dir = argv[2];
+    else
+      return usage(prog);
+    argc--;
+    argv++;
+  }
+  if (argc == 1)
+    return classic();
+  if (argc != 2 || nthreads < 1)
+    return usage(prog);
+  if (read_manifest(argv[1], &pl) < 0)
+    return -1;
+  pl.next = pl.files = pl.bytes = pl.failed = 0;
+  if (nthreads > (long)pl.jobs.size())
+    nthreads = pl.jobs.size() ? pl.jobs.size() : 1;
+  tid.resize(nthreads);
+  for (t = 0; t < nthreads; t++)
+    if (pthread_create(&tid[t], 0, worker, &pl)) {
+      std::cerr << "can not start a thread\n";
+      return -1;
+    }
+  for (t = 0; t < nthreads; t++)
+    pthread_join(tid[t], 0);
+  std::cout << "wrote " << pl.files << " files, " << pl.bytes << " bytes\n";
+  return pl.failed ? -1 : 0;
+}
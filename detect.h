@@ -0,0 +1,600 @@
+/*
+ * detect.h
+ * the detector as a library, for a program that decodes
+ * tones itself instead of piping to detect.  the detect,
+ * gen and query programs are built on it (see the
+ * Makefile), synth.h is the generator's half.
+ *
+ *    make libdetect.a libdetect.so
+ *
+ * nothing allocates once a channel is set up.  a struct
+ * detector is the caller's, on its stack or in its own
+ * arena, and samples come in from the caller's buffers
+ * and events go out to them:
+ *
+ *    struct detector d;
+ *    struct event ev[64];
+ *
+ *    det_lib_init();
+ *    det_init(&d, find_profile("dtmf"), 0);
+ *    d.whole = 1;
+ *    for(; n > 0; buf += used, n -= used) {
+ *      used = det_feed(&d, buf, n, ev, 64, &nev);
+ *      ...  nev events in ev[]  ...
+ *    }
+ *    nev = det_end(&d, ev);
+ *
+ * the only allocation is a thread's counters, on the
+ * first frame it decodes (see counts_new).  a channel
+ * is used by one thread at a time.
+ *
+ * the library and its callers must agree on UNSIGNED,
+ * THREADS, METRICS and NCHAN, as they change the
+ * samples and the structs.  it is C, C++ sees it as
+ * extern "C".
+ */
+#ifndef DETECT_H
+#define DETECT_H
+
+#include <stddef.h>         /* offsetof, for NCOUNTS */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* 
+ *
+ * goertzel aglorithm, find the power of different
+ * frequencies in an N point DFT.
+ *
+ * ftone/fsample = k/N   
+ * k and N are integers.  fsample is 8000 (8khz)
+ * this means the *maximum* frequency resolution
+ * is fsample/N (each step in k corresponds to a
+ * step of fsample/N hz in ftone)
+ *
+ * N was chosen to minimize the sum of the K errors for
+ * all the tones detected...  here are the results :
+ *
+ * Best N is 240, with the sum of all errors = 3.030002
+ * freq  freq actual   k     kactual  kerr
+ * ---- ------------  ------ ------- -----
+ *  350 (366.66667)   10.500 (11)    0.500
+ *  440 (433.33333)   13.200 (13)    0.200
+ *  480 (466.66667)   14.400 (14)    0.400
+ *  620 (633.33333)   18.600 (19)    0.400
+ *  697 (700.00000)   20.910 (21)    0.090
+ *  700 (700.00000)   21.000 (21)    0.000
+ *  770 (766.66667)   23.100 (23)    0.100
+ *  852 (866.66667)   25.560 (26)    0.440
+ *  900 (900.00000)   27.000 (27)    0.000
+ *  941 (933.33333)   28.230 (28)    0.230
+ * 1100 (1100.00000)  33.000 (33)    0.000
+ * 1209 (1200.00000)  36.270 (36)    0.270
+ * 1300 (1300.00000)  39.000 (39)    0.000
+ * 1336 (1333.33333)  40.080 (40)    0.080
+ **** I took out 1477.. too close to 1500
+ * 1477 (1466.66667)  44.310 (44)    0.310
+ ****
+ * 1500 (1500.00000)  45.000 (45)    0.000
+ * 1633 (1633.33333)  48.990 (49)    0.010
+ * 1700 (1700.00000)  51.000 (51)    0.000
+ * 2400 (2400.00000)  72.000 (72)    0.000
+ * 2600 (2600.00000)  78.000 (78)    0.000
+ *
+ * notice, 697 and 700hz are indestinguishable (same K)
+ * all other tones have a seperate k value.  
+ * these two tones must be treated as identical for our
+ * analysis.
+ *
+ * The worst tones to detect are 350 (error = 0.5, 
+ * detet 367 hz) and 852 (error = 0.44, detect 867hz). 
+ * all others are very close.
+ *
+ */
+
+#define FSAMPLE  8000
+#define N        240
+
+
+
+#define X1    0    /* 350 dialtone */
+#define X2    1    /* 440 ring, dialtone */
+#define X3    2    /* 480 ring, busy */
+#define X4    3    /* 620 busy */
+
+#define R1    4    /* 697, dtmf row 1 */
+#define R2    5    /* 770, dtmf row 2 */
+#define R3    6    /* 852, dtmf row 3 */
+#define R4    8    /* 941, dtmf row 4 */
+#define C1   10    /* 1209, dtmf col 1 */
+#define C2   12    /* 1336, dtmf col 2 */
+#define C3   13    /* 1477, dtmf col 3 */
+#define C4   14    /* 1633, dtmf col 4 */
+
+#define B1    4    /* 700, blue box 1 */
+#define B2    7    /* 900, bb 2 */
+#define B3    9    /* 1100, bb 3 */
+#define B4   11    /* 1300, bb4 */
+#define B5   13    /* 1500, bb5 */
+#define B6   15    /* 1700, bb6 */
+#define B7   16    /* 2400, bb7 */
+#define B8   17    /* 2600, bb8 */
+
+/*
+ * tones past the classic bank.  1400 (k 42) and 2300
+ * (k 69) fall exactly on a bin.  only the profiles
+ * that ask for them pay for them.
+ */
+#define T14  18    /* 1400, contact id handshake, kissoff */
+#define T23  19    /* 2300, contact id handshake */
+                   /* special information tones, 913.8 is B2 */
+#define S1   20    /* 1000 for 985.2, SIT first tone */
+#define S2   21    /* 1366 for 1370.6, SIT second tone */
+#define S2H  22    /* 1433 for 1428.5, SIT second tone */
+#define S3   23    /* 1766 for 1776.7, SIT third tone */
+#define T21  24    /* 2100, fax CED, modem ANS and ANSam */
+
+/*
+ * second harmonics of the DTMF tones, for the talk-off
+ * check.  the nearest bin, some are tones of the bank.
+ */
+#define H1   T14   /* 1394, of R1 */
+#define H2   25    /* 1533 for 1540, of R2 */
+#define H3   B6    /* 1700 for 1704, of R3 */
+#define H4   26    /* 1867 for 1882, of R4 */
+#define H5   B7    /* 2400 for 2418, of C1 */
+#define H6   27    /* 2667 for 2672, of C2 */
+#define H7   28    /* 2967 for 2954, of C3 */
+#define H8   29    /* 3267 for 3266, of C4 */
+
+#define NUMTONES 18     /* the classic bank */
+#define NUMBANK  30     /* every tone a profile can use */
+
+/* values returned by detect 
+ *  0-9     DTMF 0 through 9 or MF 0-9
+ *  10-11   DTMF *, #
+ *  12-15   DTMF A,B,C,D
+ *  16-20   MF last column: C11, C12, KP1, KP2, ST
+ *  21      2400
+ *  22      2600
+ *  23      2400 + 2600
+ *  24      DIALTONE
+ *  25      RING
+ *  26      BUSY
+ *  27      silence
+ *  28      1400
+ *  29      2300
+ *  30-32   SIT tone 1, 2, 3
+ *  33-37   call progress by cadence: dial tone, busy,
+ *          reorder, ringback, SIT (see cp_cadence())
+ *  38      1100
+ *  39      2100
+ *  40-44   fax and modem by cadence: CNG, CED, /ANS,
+ *          ANSam, /ANSam (see fax_cadence())
+ *  45      a caller ID message (see fsk_demod())
+ *  -1      invalid
+ */
+#define D0    0
+#define D1    1
+#define D2    2
+#define D3    3
+#define D4    4
+#define D5    5
+#define D6    6
+#define D7    7
+#define D8    8
+#define D9    9
+#define DSTAR 10
+#define DPND  11
+#define DA    12
+#define DB    13
+#define DC    14
+#define DD    15
+#define DC11  16
+#define DC12  17
+#define DKP1  18
+#define DKP2  19
+#define DST   20
+#define D24   21 
+#define D26   22
+#define D2426 23
+#define DDT   24
+#define DRING 25
+#define DBUSY 26
+#define DSIL  27
+#define D1400 28
+#define D2300 29
+#define DSIT1 30
+#define DSIT2 31
+#define DSIT3 32
+#define VDIAL 33
+#define VBUSY 34
+#define VREOR 35
+#define VRING 36
+#define VSIT  37
+#define D1100 38
+#define D2100 39
+#define VCNG  40
+#define VCED  41
+#define VANS  42
+#define VANSAM 43
+#define VANSPR 44
+#define VCID  45
+
+
+#define RANGE  0.1           /* any thing higher than RANGE*peak is "on" */
+#define THRESH 100.0         /* minimum level for the loudest tone */
+#define SHARE  0.25          /* talk-off: min. share of the energy in a digit */
+#define HARM   0.1           /* and max. power of a tone's 2nd harmonic */
+#define FLUSH_TIME 100       /* 100 frames = 3 seconds */
+
+/* call progress cadences, in frames of 30 ms */
+#define DIAL_MIN     10      /* steady dial tone this long */
+#define RING_MIN     10      /* ringback (2 s on) this long */
+#define BUSY_ON_MIN  13      /* busy, 0.5 s on 0.5 s off */
+#define BUSY_ON_MAX  21
+#define REOR_ON_MIN   6      /* reorder, 0.25 s on 0.25 s off */
+#define REOR_ON_MAX  11
+#define SIT_MIN       5      /* a SIT tone, 274 or 380 ms */
+#define CNG_ON_MIN   13      /* fax calling, 1100 0.5 s on 3 s off */
+#define CNG_ON_MAX   23
+#define ANS_MIN      20      /* 2100 this long for CED or ANS */
+#define ANS_GAP       2      /* frames a phase reversal may take out */
+#define AM_LOW      0.85     /* ANSam, frames this far below the peak */
+
+#ifndef NCHAN
+#define NCHAN  8             /* channels in a batch, 8 or 16 */
+#endif
+
+/* a sample as read, to a float in the range -1.0 to 1.0 */
+#ifdef UNSIGNED
+#  define SAMPLE_TO_FLOAT(x)   (((int)(unsigned char)(x) - 128) / 128.0)
+#else
+#  define SAMPLE_TO_FLOAT(x)   ((x) / 128.0)
+#endif
+
+/*
+ * the detector is a cascade, cheapest stage first:
+ *
+ *  1. energy gate:  no tone power can exceed N times the
+ *     frame energy, so frames below GATE are silence
+ *     without running any resonator.
+ *  2. pre-screen, with -DPRESCREEN:  the bank is run over
+ *     the first PRE_N samples only.  if no tone holds at
+ *     least PRE_RATIO of the (short block) energy the
+ *     frame is speech or noise and is rejected.  the
+ *     resonator state is kept, so frames that pass cost
+ *     nothing extra.  rejected frames are silence or
+ *     invalid, by the peak so far.
+ *  3. the full bank over the remaining samples.
+ *
+ * the pre-screen is lossy, a digit whose first PRE_N
+ * samples are mostly speech or noise is thrown out with
+ * them.  on 120 runs of 40 random digits (noise up to
+ * 0.1 of full scale, babble between and into the digits,
+ * onsets jittered within a frame) it found 4640 of the
+ * 4800 digits to the full bank's 4674, none lost on the
+ * clean runs.  so it is off unless asked for.
+ */
+#define GATE      (0.99 * THRESH / N)   /* minimum frame energy */
+#define PRE_N     80                    /* samples in the pre-screen */
+#define PRE_RATIO 0.0625                /* min. tone power / (PRE_N*energy) */
+
+extern int k[];            /* goertzel k of each tone, see detector.c */
+extern float coef[];
+extern int harm[];         /* bank index of a tone's 2nd harmonic, or 0 */
+extern char *dtran[];      /* the codes as text */
+
+/*
+ * counters, one set per thread so that counting
+ * never shares a cache line.  every thread's set
+ * is on a list and counts_sum() adds them up when
+ * somebody asks, which is rarely.
+ *
+ * the cascade counts are always kept.  -DMETRICS
+ * adds results by kind, stage and kernel timings
+ * and detect.c's exposition; without it the M_
+ * macros are empty and cost nothing.
+ */
+#ifdef THREADS
+#  define LOCAL __thread
+#else
+#  define LOCAL
+#endif
+
+#define S_READ    0       /* stages, for the timings */
+#define S_DECODE  1
+#define S_WRITE   2
+#define NSTAGES   3
+
+#define NBUCKETS  16      /* latency buckets, 256 ns up in powers of 2 */
+#define MAXKERNELS 16     /* the profiles' kernels, then the batch kernel */
+#define K_BATCH   (MAXKERNELS-1)
+
+struct counts {
+  struct counts *next;
+  long frames, gated, screened, bank;     /* the cascade */
+  long rejected;                          /* by the DTMF checks */
+#ifdef METRICS
+  long silence, invalid, tones;           /* results */
+  long stage_ns[NSTAGES], stage_n[NSTAGES];
+  long hist[NSTAGES][NBUCKETS];
+  long kernel_ns[MAXKERNELS], kernel_n[MAXKERNELS];
+#endif
+};
+#define NCOUNTS  ((sizeof(struct counts) - offsetof(struct counts, frames)) \
+                  / sizeof(long))
+
+
+extern struct counts *all_counts;
+extern LOCAL struct counts *my_counts;
+struct counts *counts_new();
+#define CNT  (my_counts? my_counts: counts_new())
+
+long now_ns();
+
+#ifdef METRICS
+int metric_stage(int s, long ns);
+int metric_result(int x);
+#  define M_VAR(t)       long t
+#  define M_START(t)     ((t) = now_ns())
+#  define M_STAGE(s,t)   metric_stage(s, now_ns() - (t))
+#  define M_KERNEL(k,t,n)  (CNT->kernel_ns[k] += now_ns() - (t), \
+                            CNT->kernel_n[k] += (n))
+#  define M_RESULT(x)    metric_result(x)
+#else
+#  define M_VAR(t)
+#  define M_START(t)
+#  define M_STAGE(s,t)
+#  define M_KERNEL(k,t,n)
+#  define M_RESULT(x)
+#endif
+
+/*
+ * static probes, for a tracer outside the process
+ * (bpftrace, perf, systemtap) to attach to a detect
+ * that is running.  they are USDT, a nop each and a
+ * note in the binary, built in wherever <sys/sdt.h>
+ * (systemtap-sdt-dev) is, unless -DNOSDT:
+ *
+ *    dtmf:frame_read(chan)
+ *    dtmf:power_start(chan, n)     the goertzel of n channels
+ *    dtmf:power_end(chan, n)       n of them past the prescreen
+ *    dtmf:decode_result(chan, x)
+ *    dtmf:event_emit(chan, code, start)
+ *
+ *    bpftrace -e 'usdt:./DTMFdetect:dtmf:decode_result { @[arg1] = count(); }'
+ */
+#if !defined(NOSDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HAVE_SDT
+#endif
+#endif
+#ifdef HAVE_SDT
+#  define PROBE1(name,a)      DTRACE_PROBE1(dtmf, name, a)
+#  define PROBE2(name,a,b)    DTRACE_PROBE2(dtmf, name, a, b)
+#  define PROBE3(name,a,b,c)  DTRACE_PROBE3(dtmf, name, a, b, c)
+#else
+#  define PROBE1(name,a)
+#  define PROBE2(name,a,b)
+#  define PROBE3(name,a,b,c)
+#endif
+
+
+/*
+ * detection profiles.  a profile is the list of tones
+ * it needs, a goertzel kernel built for exactly that
+ * list and a classifier that only looks at those tones.
+ * a channel that only wants DTMF runs 8 resonators
+ * instead of 18.
+ */
+struct profile {
+  char *name;
+  int (*cadence)();      /* (dp, x, at) verdicts from the results, or 0 */
+  int phase;             /* tones[] index of the tone to keep the phase of */
+  int ntones;            /* classified */
+  int nbank;             /* run, the ntones and harmonics */
+  int *tones;            /* index into k[], coef[] */
+  int (*resonate)();     /* (x, from, to, u0, u1) */
+  int (*power)();        /* (u0, u1, power) */
+  int (*classify)();     /* (dp, power) */
+};
+
+/* something to output about a channel, see frame_events */
+#define MAXEVENTS  5           /* from one frame */
+#define CID_TEXT   64          /* a caller ID as text */
+#define E_EARLY    1           /* flags, see read_early() */
+#define E_CONFIRM  2
+#define E_RETRACT  4
+struct event {
+  int chan;
+  int code;              /* result code, DSIL for an end of line */
+  int flags;             /* an early decision, or what became of it */
+  long start, end;       /* sample offsets, end is one past */
+  float peak[2];         /* power of the two strongest tones */
+  char text[CID_TEXT];   /* VCID: date, number and name */
+};
+
+/* call progress by cadence, see cp_cadence() and fax_cadence() */
+struct cadence {
+  int tone;              /* the call progress tone on, or -1 */
+  int on;                /* frames since it came on */
+  int off;               /* frames since a tone was on */
+  int had_off;           /* this tone came after a gap, not mid way */
+  int sit;               /* SIT tones seen in order */
+  int verdict;           /* the last one given, or -1 */
+  long start;            /* sample the tone began at */
+  long since;            /* and the one the verdict is about */
+  int rev;               /* 2100: phase reversals */
+  int good, low;         /* frames at full power, of them under AM_LOW */
+  float pmax;            /* peak power of the tone */
+  float z[2];            /* last phase at full power */
+  float d[2];            /* the phase step per frame, 0 until known */
+  long zat;              /* sample z is from */
+};
+
+/* caller ID, see fsk_demod() */
+#define FSK_L     7            /* correlator length, about a bit */
+#define FSK_TAB   40           /* samples in a period of both tones */
+struct fsk {
+  float prod[4][FSK_L];  /* the last products: mark i,q, space i,q */
+  float sum[4];          /* and their sums */
+  int pos;               /* in prod[] */
+  int ph;                /* of the oscillators, mod FSK_TAB */
+  float d[3];            /* mark less space, the last 3 samples */
+  int mark;              /* samples of mark in a row */
+  int bit;               /* being received, see fsk_demod() */
+  int idle;              /* mark before the start bit */
+  long clock, next;      /* in thirds of a sample */
+  int byte;
+  int state;             /* of the message, see fsk_byte() */
+  int len, n, check;     /* length, bytes so far, their sum */
+  long start;            /* sample the message began at */
+  unsigned char msg[2+255];
+  int ready;             /* a message is in text */
+  char text[CID_TEXT];
+};
+
+/*
+ * the power dump, see spec_frame().  a header, then
+ * blocks of SPEC_BLOCK frames of a channel, column by
+ * column: the power of each tone of the classic bank,
+ * then the threshold each frame was decoded at (-L and
+ * adapt move it) and the results, with the channel's
+ * range.  every block is SPEC_SIZE, so block
+ * b is at sizeof(struct spec_head) + b * SPEC_SIZE and
+ * the file can be mapped and read a column at a time.
+ */
+#define SPEC_BLOCK    1024
+#define SPEC_VERSION  2
+struct spec_head {
+  char magic[4];         /* DTPW */
+  int version;           /* SPEC_VERSION */
+  int ntones, block;     /* NUMTONES, SPEC_BLOCK */
+  int n, fsample;        /* N, FSAMPLE */
+  int k[NUMTONES];       /* of the tones */
+};
+struct spec {
+  int chan;
+  int nframes;           /* in the block, SPEC_BLOCK but the last */
+  long long first;       /* frame number of the first */
+  float range;           /* the channel's, lv.range */
+  float power[NUMTONES][SPEC_BLOCK];
+  float thresh[SPEC_BLOCK];
+  signed char result[SPEC_BLOCK];
+};
+#define SPEC_SIZE  sizeof(struct spec)
+
+/* where a dump goes, shared by the channels */
+struct specfile {
+  int fd;
+  long long off;         /* of the next block */
+};
+
+/* what a channel is decoded at, see levels_init() */
+struct levels {
+  float thresh;          /* min. power of the loudest tone */
+  float range;           /* of the loudest, for a tone to be on */
+  float adapt;           /* the threshold this many dB over the floor, or 0 */
+  float twist, rtwist;   /* DTMF: most dB row over column, column over row */
+  float share;           /* DTMF: least share of the energy in the tones */
+  float harm;            /* DTMF: most power of a 2nd harmonic, of its tone */
+};
+
+/* the state of one channel */
+struct detector {
+  struct profile *prof;
+  int MFmode;
+  int chan;              /* channel number, -1 if the only one */
+  int last;              /* last result, for dtmf_to_ascii */
+  int silence_time;      /* frames of silence since */
+  long nframe;           /* frames so far */
+  float peak[2];         /* power of the two strongest tones, this frame */
+  int top[2];            /* the two strongest tones */
+  float hp[2];           /* power of the peaks' 2nd harmonics */
+  float z[2];            /* the profile's phase tone, this frame */
+  struct event open;     /* the tone going on, see frame_events */
+  struct cadence cad;
+  struct fsk fsk;
+  int prov;              /* provisional digit, or -1, see read_early() */
+  int delay;             /* of the input's resampler, see rs_init() */
+  int whole;             /* events are whole tones, not text's */
+  int callerid;          /* decode caller ID too */
+  int have;              /* samples in part[], see det_feed() */
+  char part[N];
+  struct specfile *dump; /* the power dump, or 0 */
+  struct spec *spec;     /* its block being filled */
+  struct levels lv;      /* see det_levels() */
+  float thresh, gate;    /* now, for the loudest tone and the frame */
+  float floor, level;    /* noise floor (energy), tone level (power) */
+  float over, tw, rtw;   /* lv's dB as ratios */
+};
+
+struct batch {
+  float x[N][NCHAN];
+  float energy[NCHAN], pre[NCHAN];
+  int nchan;              /* lanes in use */
+  int lanes;              /* lanes run, nchan rounded up for the kernel */
+  int ntones;             /* tones of all the lanes' profiles */
+  int tones[NUMBANK];
+};
+
+/* a batch kernel, see det_tune() */
+struct kernel {
+  char *name;
+  int (*resonate)();
+  int step;               /* lanes at a time */
+  int usable;             /* on this CPU, as last tuned */
+  int agrees;             /* with plain */
+  double ns;              /* a channel frame, as tuned or cached */
+};
+extern struct kernel kernels[], *the_kernel;
+extern int batch_lanes;   /* channels a batch, NCHAN or fewer */
+extern char *tune_from;   /* default, cache, tuned or set */
+
+struct partial {
+  float x[N];
+  float u0[NUMBANK], u1[NUMBANK];
+  int n;                 /* samples run so far */
+};
+
+extern struct profile profiles[];
+
+/* the library */
+void det_lib_init(void);
+int det_init(struct detector *dp, struct profile *pp, int chan);
+struct profile *find_profile(const char *name);
+long det_feed(struct detector *dp, const char *data, long n,
+              struct event *ev, int maxev, int *nev);
+int det_end(struct detector *dp, struct event *ev);
+void levels_init(struct levels *lv);
+int levels_parse(struct levels *lv, const char *spec);
+void det_levels(struct detector *dp, struct levels *lv);
+
+/* a frame at a time, as detect.c does */
+int decode(struct detector *dp, char *data);
+int decode_float(struct detector *dp, float *x);
+int calc_power_float(float *x, float *power);
+int frame_events(struct detector *dp, int x, struct event *ev);
+int last_event(struct detector *dp, struct event *ev);
+int set_event(struct event *ev, struct detector *dp, int code,
+              long start, long end);
+int counts_sum(struct counts *sum);
+int spec_open(struct specfile *sf, int fd);
+
+/* samples as read, signed or unsigned */
+int batch_ingest();
+int batch_decode(struct batch *bp, struct detector *dp, int *x);
+int det_tune(const char *cache, int force, int verbose);
+int set_kernel(const char *spec);
+int has_dtmf(struct profile *pp);
+int early_part();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DETECT_H */
@@ -0,0 +1,2476 @@
+/*
+ * detector.c
+ * the detector as a library, see detect.h.  this is
+ * the decoding detect.c did itself: the tables, the
+ * goertzel kernels and their profiles, the classifiers,
+ * call progress, caller ID and the events, with the
+ * counters they keep.
+ *
+ *    cc -c -DUNSIGNED detector.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define X86_KERNELS            /* avx and avx512, see the batch kernels */
+#include <immintrin.h>
+#endif
+#include "detect.h"
+
+int k[] = { 11, 13, 14, 19, 21, 23, 26, 27, 28, 33, 36, 39, 40,
+ /*44,*/ 45, 49, 51, 72, 78,
+ 42, 69, 30, 41, 43, 53, 63,
+ 46, 56, 80, 89, 98, };
+
+/* coefficients for above k's as:
+ *   2 * cos( 2*pi* k/N )
+ */
+float coef[] = {
+1.917639, 1.885283, 1.867161, 1.757634, 
+1.705280, 1.648252, 1.554292, 1.520812, 1.486290, 
+1.298896, 1.175571, 1.044997, 1.000000, /* 0.813473,*/ 
+0.765367, 0.568031, 0.466891, -0.618034, -0.907981,
+0.907981, -0.466891, 1.414214, 0.954318, 0.861022, 0.364471,
+-0.156918,
+0.716736, 0.209057, -1.000000, -1.376709, -1.677341, };
+
+/* the bank index of the second harmonic of each DTMF tone, else 0 */
+int harm[NUMBANK] = { 0, 0, 0, 0, H1, H2, H3, 0, H4, 0, H5, 0, H6, H7, H8 };
+
+/* translation of above codes into text */
+char *dtran[] = {
+  "0", "1", "2", "3", "4", "5", "6", "7", "8", "9",
+  "*", "#", "A", "B", "C", "D", 
+  "+C11 ", "+C12 ", " KP1+", " KP2+", "+ST ",
+  " 2400 ", " 2600 ", " 2400+2600 ",
+  " DIALTONE ", " RING ", " BUSY ","",
+  " 1400 ", " 2300 ",
+  " SIT1 ", " SIT2 ", " SIT3 ",
+  " =DIALTONE ", " =BUSY ", " =REORDER ", " =RINGBACK ", " =SIT ",
+  " 1100 ", " 2100 ",
+  " =CNG ", " =CED ", " =/ANS ", " =ANSam ", " =/ANSam ",
+  " CID " };
+
+
+struct counts *all_counts;
+LOCAL struct counts *my_counts;
+
+/* this thread's counters, made on first use */
+struct counts *counts_new()
+{
+  struct counts *cp;
+
+  cp = (struct counts *)calloc(1, sizeof(*cp));
+  if(!cp) {
+    perror("counts");
+    exit(-1);
+  }
+  do
+    cp->next = all_counts;
+  while(!__sync_bool_compare_and_swap(&all_counts, cp->next, cp));
+  return(my_counts = cp);
+}
+
+/* the counts of every thread, added up in 'sum' */
+counts_sum(sum)
+struct counts *sum;
+{
+  struct counts *cp;
+  long *from, *to;
+  int i;
+
+  memset(sum, 0, sizeof(*sum));
+  for(cp=all_counts; cp; cp=cp->next) {
+    from = &cp->frames;
+    to = &sum->frames;
+    for(i=0; i<NCOUNTS; i++)
+      to[i] += from[i];
+  }
+  return(0);
+}
+
+/* the monotonic clock, in ns */
+long now_ns()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return(ts.tv_sec * 1000000000L + ts.tv_nsec);
+}
+
+#ifdef METRICS
+
+/* 'ns' spent in stage s */
+metric_stage(s,ns)
+int s;
+long ns;
+{
+  struct counts *cp = CNT;
+  int b;
+
+  cp->stage_ns[s] += ns;
+  cp->stage_n[s]++;
+  for(b=0, ns >>= 8; ns && b<NBUCKETS-1; b++)
+    ns >>= 1;
+  cp->hist[s][b]++;
+  return(0);
+}
+
+/* the result x of a frame */
+metric_result(x)
+int x;
+{
+  struct counts *cp = CNT;
+
+  if(x == DSIL)
+    cp->silence++;
+  else if(x < 0)
+    cp->invalid++;
+  else
+    cp->tones++;
+  return(0);
+}
+
+#endif
+
+/*
+ * convert the N samples in 'data' to floats in 'x'
+ *
+ * returns the energy of the frame, the energy of
+ * the first PRE_N samples is left in 'pre'
+ */
+float frame_energy(data,x,pre)
+#ifdef UNSIGNED
+unsigned char *data;
+#else
+char *data;
+#endif
+float *x, *pre;
+{
+  float e,in;
+  int i;
+
+  for(i=0, e=0.0; i<N; i++) {
+    in = SAMPLE_TO_FLOAT(data[i]);
+    x[i] = in;
+    e += in * in;
+    if(i == PRE_N-1)
+      *pre = e;
+  }
+  return(e);
+}
+
+
+
+
+
+
+det_init(dp,pp,chan)
+struct detector *dp;
+struct profile *pp;
+int chan;
+{
+  dp->prof = pp;
+  dp->MFmode = 0;
+  dp->chan = chan;
+  dp->last = DSIL;
+  dp->silence_time = 0;
+  dp->nframe = 0;
+  dp->peak[0] = dp->peak[1] = 0.0;
+  dp->open.code = -1;
+  dp->cad.tone = -1;
+  dp->cad.on = dp->cad.off = 0;
+  dp->cad.had_off = 0;
+  dp->cad.sit = 0;
+  dp->cad.verdict = -1;
+  dp->cad.rev = 0;
+  dp->z[0] = dp->z[1] = 0.0;
+  memset(&dp->fsk, 0, sizeof(dp->fsk));
+  dp->fsk.bit = -2;
+  dp->prov = -1;
+  dp->delay = 0;
+  dp->whole = 0;
+  dp->callerid = 0;
+  dp->have = 0;
+  dp->dump = 0;
+  dp->spec = 0;
+  levels_init(&dp->lv);
+  det_levels(dp, &dp->lv);
+  return(0);
+}
+
+/*
+ * KERNEL(name) expands the goertzel kernel for the tone
+ * list name_tones[].  the number of tones is a constant
+ * to the compiler, so the inner loop is unrolled and the
+ * coefficients stay in registers.
+ *
+ * name_resonate() runs the resonators in u0,u1 (one per
+ * tone of the list) over samples 'from' up to 'to' of x.
+ * name_power() is the feedforward, it stores the power
+ * of each tone in power[] at the tone's bank index.
+ */
+#define NT(name)  (sizeof(name##_tones) / sizeof(int))
+
+#define KERNEL(name)                                    \
+name##_resonate(x,from,to,u0,u1)                        \
+float *x, *u0, *u1;                                     \
+int from, to;                                           \
+{                                                       \
+  float c[NT(name)],t,in;                               \
+  int i,j;                                              \
+                                                        \
+  for(j=0; j<NT(name); j++)                             \
+    c[j] = coef[name##_tones[j]];                       \
+  for(i=from; i<to; i++) {   /* feedback */             \
+    in = x[i];                                          \
+    for(j=0; j<NT(name); j++) {                         \
+      t = u0[j];                                        \
+      u0[j] = in + c[j] * u0[j] - u1[j];                \
+      u1[j] = t;                                        \
+    }                                                   \
+  }                                                     \
+  return(0);                                            \
+}                                                       \
+                                                        \
+name##_power(u0,u1,power)                               \
+float *u0, *u1, *power;                                 \
+{                                                       \
+  float c;                                              \
+  int j;                                                \
+                                                        \
+  for(j=0; j<NT(name); j++) {   /* feedforward */       \
+    c = coef[name##_tones[j]];                          \
+    power[name##_tones[j]] =                            \
+      u0[j] * u0[j] + u1[j] * u1[j] - c * u0[j] * u1[j];\
+  }                                                     \
+  return(0);                                            \
+}
+
+/*
+ * the DTMF profiles run the second harmonics of the
+ * DTMF tones too, last, for the talk-off check.  the
+ * classifiers see only the first ntones.  H3 and H5 are
+ * in the classic bank already.
+ */
+int full_tones[] = { X1, X2, X3, X4, 4, 5, 6, 7, 8, 9,
+                     10, 11, 12, 13, 14, 15, 16, 17,
+                     H1, H2, H4, H6, H7, H8 };
+int dtmf_tones[] = { R1, R2, R3, R4, C1, C2, C3, C4,
+                     H1, H2, H3, H4, H5, H6, H7, H8 };
+int mf_tones[]   = { B1, B2, B3, B4, B5, B6, B7, B8 };
+int cp_tones[]   = { X1, X2, X3, X4, B2, S1, S2, S2H, S3 };
+int cid_tones[]  = { R1, R2, R3, R4, C1, C2, C3, C4, T14, T23,
+                     H2, H3, H4, H5, H6, H7, H8 };
+int fax_tones[]  = { B3, T21 };
+
+KERNEL(full)
+KERNEL(dtmf)
+KERNEL(mf)
+KERNEL(cp)
+KERNEL(cid)
+KERNEL(fax)
+
+/*
+ * the phase of 'tone' at the end of the frame, from
+ * its resonator state u0,u1, into z (re, im).
+ * the feedforward of the goertzel without the power.
+ */
+phasor(tone,u0,u1,z)
+int tone;
+float u0, u1, *z;
+{
+  float c = coef[tone] / 2.0;
+
+  z[0] = u0 - c * u1;
+  z[1] = sqrt(1.0 - c * c) * u1;
+  return(0);
+}
+
+/*
+ * calculate the power of each tone according
+ * to a modified goertzel algorithm described in
+ *  _digital signal processing applications using the
+ *  ADSP-2100 family_ by Analog Devices
+ *
+ * input is 'data',  N sample values
+ *
+ * ouput is 'power', NUMTONES values
+ *  corresponding to the power of each tone 
+ */
+
+calc_power(data,power)
+#ifdef UNSIGNED
+unsigned char *data;
+#else
+char *data;
+#endif
+float *power;
+{
+  float x[N],pre;
+
+  frame_energy(data,x,&pre);
+  return(calc_power_float(x,power));
+}
+
+/* calc_power(), for N floats from -1.0 to 1.0 */
+calc_power_float(x,power)
+float *x, *power;
+{
+  float u0[NT(full)],u1[NT(full)];
+  int j;
+
+  for(j=0; j<NT(full); j++) {
+    u0[j] = 0.0;
+    u1[j] = 0.0;
+  }
+  full_resonate(x,0,N,u0,u1);
+  full_power(u0,u1,power);
+  return(0);
+}
+
+/*
+ * DTMF digit for a row and column, 0-3 each
+ */
+dtmf_digit(row,col)
+int row,col;
+{
+  if(col == 3)  /* A,B,C,D */
+    return(DA + row);
+  if(row == 3 && col == 0 ) 
+    return(DSTAR);
+  if(row == 3 && col == 2 )
+    return(DPND);
+  if(row == 3)
+    return(D0);
+  return(D1 + col + row*3);
+}
+
+/*
+ * MF digit for two blue box tones, 0-7 each
+ * b1 has upper number, b2 has lower
+ */
+mf_digit(dp,b1,b2)
+struct detector *dp;
+int b1,b2;
+{
+  switch(b1) {
+    case 7: return( (b2==6)? D2426: -1); 
+    case 6: return(-1);
+    case 5: if(b2==2 || b2==3)  /* KP */
+              dp->MFmode=1;
+            if(b2==4)  /* ST */
+              dp->MFmode=0; 
+            return(DC11 + b2);
+    /* MF 7 conflicts with DTMF 3, but if we made it
+     * here then DTMF 3 was already tested for 
+     */
+    case 4: return( (b2==3)? D0: D7 + b2);
+    case 3: return(D4 + b2);
+    case 2: return(D2 + b2);
+    case 1: return(D1);
+  }
+  return(-1);
+}
+
+/*
+ * which of the tones of the profile of dp are on
+ *
+ * sets on[] for the tones of the profile, returns the
+ * number on or -1 if the loudest is below the threshold
+ */
+tones_on(dp,power,on)
+struct detector *dp;
+float *power;
+int *on;
+{
+  struct profile *pp = dp->prof;
+  float thresh,maxpower;
+  int i,on_count;
+
+  for(i=0, maxpower=0.0; i<pp->ntones; i++)
+    if(power[pp->tones[i]] > maxpower)
+      maxpower = power[pp->tones[i]];
+  if(maxpower < dp->thresh)  /* silence? */ 
+    return(-1);
+  thresh = dp->lv.range * maxpower;    /* allowable range of powers */
+  for(i=0, on_count=0; i<pp->ntones; i++) {
+    on[pp->tones[i]] = power[pp->tones[i]] > thresh;
+    on_count += on[pp->tones[i]];
+  }
+  return(on_count);
+}
+
+/*
+ * the row and column of a DTMF pair, as
+ * row*4 + col, or -1 if on[] is not one
+ */
+dtmf_pair(on)
+int *on;
+{
+  static int r[] = { R1, R2, R3, R4 }, c[] = { C1, C2, C3, C4 };
+  int i, row, col, rcount, ccount;
+
+  for(i=0, rcount=0, ccount=0; i<4; i++) {
+    if(on[r[i]]) {
+      rcount++;
+      row = i;
+    }
+    if(on[c[i]]) {
+      ccount++;
+      col = i;
+    }
+  }
+  if(rcount==1 && ccount==1)
+    return(row*4 + col);
+  return(-1);
+}
+
+/*
+ * detect which signals are present.
+ *
+ * the classifiers below all take the power of
+ * the tones of their profile and return the
+ * values defined in the include file.
+ *
+ * classify_full is the original detector.
+ * note: DTMF 3 and MF 7 conflict.  To resolve
+ * this the program only reports MF 7 between
+ * a KP and an ST, otherwise DTMF 3 is returned
+ */
+classify_full(dp,power)
+struct detector *dp;
+float *power;
+{
+  float thresh,maxpower;
+  int on[NUMTONES],on_count;
+  int bcount, rcount, ccount;
+  int row, col, b1, b2, i;
+  int r[4],c[4],b[8];
+  
+  for(i=0, maxpower=0.0; i<NUMTONES;i++)
+    if(power[i] > maxpower)
+      maxpower = power[i]; 
+/*
+for(i=0;i<NUMTONES;i++) 
+  printf("%f, ",power[i]);
+printf("\n");
+*/
+
+  if(maxpower < dp->thresh)  /* silence? */ 
+    return(DSIL);
+  thresh = dp->lv.range * maxpower;    /* allowable range of powers */
+  for(i=0, on_count=0; i<NUMTONES; i++) {
+    if(power[i] > thresh) { 
+      on[i] = 1;
+      on_count ++;
+    } else
+      on[i] = 0;
+  }
+
+/*
+printf("%4d: ",on_count);
+for(i=0;i<NUMTONES;i++)
+  putchar('0' + on[i]);
+printf("\n");
+*/
+
+  if(on_count == 1) {
+    if(on[B7]) 
+      return(D24);
+    if(on[B8])
+      return(D26);
+    return(-1);
+  }
+ 
+  if(on_count == 2) {
+    if(on[X1] && on[X2])
+      return(DDT);
+    if(on[X2] && on[X3])
+      return(DRING);
+    if(on[X3] && on[X4])
+      return(DBUSY);
+    
+    b[0]= on[B1]; b[1]= on[B2]; b[2]= on[B3]; b[3]= on[B4];
+    b[4]= on[B5]; b[5]= on[B6]; b[6]= on[B7]; b[7]= on[B8];
+    c[0]= on[C1]; c[1]= on[C2]; c[2]= on[C3]; c[3]= on[C4];
+    r[0]= on[R1]; r[1]= on[R2]; r[2]= on[R3]; r[3]= on[R4];
+
+    for(i=0, bcount=0; i<8; i++) {
+      if(b[i]) {
+        bcount++;
+        b2 = b1;
+        b1 = i;
+      }
+    }
+    for(i=0, rcount=0; i<4; i++) {
+      if(r[i]) {
+        rcount++;
+        row = i;
+      }
+    }
+    for(i=0, ccount=0; i<4; i++) {
+      if(c[i]) {
+        ccount++;
+        col = i;
+      }
+    }
+
+    if(rcount==1 && ccount==1) {   /* DTMF */
+      if(row == 0 && col == 2) {   /* DTMF 3 conflicts with MF 7 */
+        if(!dp->MFmode)
+          return(D3);
+      } else 
+        return(dtmf_digit(row,col));
+    }
+
+    if(bcount == 2)        /* MF */
+      return(mf_digit(dp,b1,b2));
+    return(-1);
+  }
+
+  if(on_count == 0)
+    return(DSIL);
+  return(-1); 
+}
+
+/*
+ * classify_full by table.
+ *
+ * what classify_full returns depends only on which
+ * tones are on, and MFmode, and only when one or two
+ * are.  so the on/off decisions are packed into a mask
+ * (a compare and movemask with SSE), the lowest and the
+ * highest tone on make the key lo*NUMTONES+hi (one tone
+ * on has lo == hi) and the result and the new MFmode
+ * are looked up.  silence or more tones is the last
+ * key.  the tables are made by running classify_full
+ * itself on every key, so the two agree by design,
+ * DTMF 3 against MF 7 included.
+ *
+ * compile with -DNOTABLE for classify_full itself.
+ */
+#define NKEYS  (NUMTONES*NUMTONES + 1)
+
+signed char class_tab[2][NKEYS];   /* [MFmode][key] */
+signed char mode_tab[2][NKEYS];
+
+class_init()
+{
+  struct detector d;
+  float power[NUMBANK];
+  int m, lo, hi, i, key;
+
+  for(m=0; m<2; m++) {
+    class_tab[m][NKEYS-1] = -1;
+    mode_tab[m][NKEYS-1] = m;
+    for(lo=0; lo<NUMTONES; lo++)
+      for(hi=lo; hi<NUMTONES; hi++) {
+        for(i=0; i<NUMBANK; i++)
+          power[i] = 0.0;
+        power[lo] = power[hi] = THRESH;
+        d.MFmode = m;
+        d.thresh = THRESH;
+        d.lv.range = RANGE;
+        key = lo*NUMTONES + hi;
+        class_tab[m][key] = classify_full(&d,power);
+        mode_tab[m][key] = d.MFmode;
+      }
+  }
+  return(0);
+}
+
+classify_table(dp,power)
+struct detector *dp;
+float *power;
+{
+  float maxpower, thresh;
+  unsigned mask;
+  int i, n, key, x;
+#ifdef __SSE__
+  __m128 v[4], m, t;
+
+  for(i=0; i<4; i++)
+    v[i] = _mm_loadu_ps(power + 4*i);
+  m = _mm_max_ps(_mm_max_ps(v[0], v[1]), _mm_max_ps(v[2], v[3]));
+  m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1,0,3,2)));
+  m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2,3,0,1)));
+  maxpower = _mm_cvtss_f32(m);
+  for(i=16; i<NUMTONES; i++)
+    if(power[i] > maxpower)
+      maxpower = power[i];
+  thresh = dp->lv.range * maxpower;
+  t = _mm_set1_ps(thresh);
+  for(i=0, mask=0; i<4; i++)
+    mask |= _mm_movemask_ps(_mm_cmpgt_ps(v[i], t)) << 4*i;
+  for(i=16; i<NUMTONES; i++)
+    mask |= (power[i] > thresh) << i;
+#else
+  for(i=0, maxpower=0.0; i<NUMTONES; i++)
+    maxpower = (power[i] > maxpower)? power[i]: maxpower;
+  thresh = dp->lv.range * maxpower;
+  for(i=0, mask=0; i<NUMTONES; i++)
+    mask |= (power[i] > thresh) << i;
+#endif
+  n = __builtin_popcount(mask);
+  key = __builtin_ctz(mask | 1 << NUMTONES) * NUMTONES +
+        31 - __builtin_clz(mask | 1);
+  key = (maxpower < dp->thresh || n > 2)? NKEYS-1: key;
+  x = class_tab[dp->MFmode][key];
+  dp->MFmode = mode_tab[dp->MFmode][key];
+  return((maxpower < dp->thresh)? DSIL: x);
+}
+
+/* DTMF only, no MF so 3 is always DTMF 3 */
+classify_dtmf(dp,power)
+struct detector *dp;
+float *power;
+{
+  int on[NUMBANK],x;
+
+  x = tones_on(dp,power,on);
+  if(x < 0)
+    return(DSIL);
+  if(x != 2 || (x = dtmf_pair(on)) < 0)
+    return(-1);
+  return(dtmf_digit(x/4, x%4));
+}
+
+/* MF only, no DTMF so 700+1500 is always MF 7 */
+classify_mf(dp,power)
+struct detector *dp;
+float *power;
+{
+  static int b[] = { B1, B2, B3, B4, B5, B6, B7, B8 };
+  int on[NUMBANK],x,i,b1,b2;
+
+  x = tones_on(dp,power,on);
+  if(x < 0)
+    return(DSIL);
+  if(x == 1) {
+    if(on[B7])
+      return(D24);
+    if(on[B8])
+      return(D26);
+    return(-1);
+  }
+  if(x != 2)
+    return(-1);
+  for(i=0; i<8; i++) {
+    if(on[b[i]]) {
+      b2 = b1;
+      b1 = i;
+    }
+  }
+  return(mf_digit(dp,b1,b2));
+}
+
+/* call progress only, with the special information tones */
+classify_cp(dp,power)
+struct detector *dp;
+float *power;
+{
+  int on[NUMBANK],x;
+
+  x = tones_on(dp,power,on);
+  if(x < 0)
+    return(DSIL);
+  if(x == 1) {
+    if(on[B2] || on[S1])
+      return(DSIT1);
+    if(on[S2] || on[S2H])
+      return(DSIT2);
+    if(on[S3])
+      return(DSIT3);
+    return(-1);
+  }
+  if(x != 2)
+    return(-1);
+  if(on[X1] && on[X2])
+    return(DDT);
+  if(on[X2] && on[X3])
+    return(DRING);
+  if(on[X3] && on[X4])
+    return(DBUSY);
+  return(-1);
+}
+
+/* contact id, DTMF digits and the 1400/2300 handshake */
+classify_cid(dp,power)
+struct detector *dp;
+float *power;
+{
+  int on[NUMBANK],x;
+
+  x = tones_on(dp,power,on);
+  if(x < 0)
+    return(DSIL);
+  if(x == 1) {
+    if(on[T14])
+      return(D1400);
+    if(on[T23])
+      return(D2300);
+    return(-1);
+  }
+  if(x != 2 || (x = dtmf_pair(on)) < 0)
+    return(-1);
+  return(dtmf_digit(x/4, x%4));
+}
+
+/* fax and modem answer tones */
+classify_fax(dp,power)
+struct detector *dp;
+float *power;
+{
+  int on[NUMBANK],x;
+
+  x = tones_on(dp,power,on);
+  if(x < 0)
+    return(DSIL);
+  if(x != 1)
+    return(-1);
+  return(on[B3]? D1100: D2100);
+}
+
+#define PROFILE(name,cad,ph,nh)  { #name, cad, ph, NT(name)-(nh), NT(name), \
+                     name##_tones, name##_resonate, name##_power, classify_##name }
+
+int cp_cadence(), fax_cadence();
+
+struct profile profiles[] = {
+#ifdef NOTABLE
+  PROFILE(full,0,-1,6),  /* the default, everything the classic bank has */
+#else
+  { "full", 0, -1, NUMTONES, NT(full), full_tones,
+    full_resonate, full_power, classify_table },
+#endif
+  PROFILE(dtmf,0,-1,8),
+  PROFILE(mf,0,-1,0),
+  PROFILE(cp,cp_cadence,-1,0),
+  PROFILE(cid,0,-1,7),
+  PROFILE(fax,fax_cadence,1,0),   /* the phase of 2100 */
+  { 0 } };
+
+struct profile *find_profile(name)
+const char *name;
+{
+  struct profile *pp;
+
+  for(pp=profiles; pp->name; pp++)
+    if(!strcmp(pp->name, name))
+      return(pp);
+  return(0);
+}
+
+/*
+ * keep the power of the two strongest tones
+ * of the profile of dp, for the events, and of
+ * their second harmonics if the profile has them
+ */
+set_peaks(dp,power)
+struct detector *dp;
+float *power;
+{
+  struct profile *pp = dp->prof;
+  float p;
+  int i,top[2];
+
+  dp->peak[0] = dp->peak[1] = 0.0;
+  top[0] = top[1] = 0;
+  for(i=0; i<pp->ntones; i++) {
+    p = power[pp->tones[i]];
+    if(p > dp->peak[0]) {
+      dp->peak[1] = dp->peak[0];
+      dp->peak[0] = p;
+      top[1] = top[0];
+      top[0] = pp->tones[i];
+    } else if(p > dp->peak[1]) {
+      dp->peak[1] = p;
+      top[1] = pp->tones[i];
+    }
+  }
+  dp->top[0] = top[0];
+  dp->top[1] = top[1];
+  dp->hp[0] = dp->hp[1] = 0.0;
+  if(pp->nbank > pp->ntones) {
+    if(harm[top[0]])
+      dp->hp[0] = power[harm[top[0]]];
+    if(harm[top[1]])
+      dp->hp[1] = power[harm[top[1]]];
+  }
+  return(0);
+}
+
+/*
+ * bell 202 caller ID.
+ *
+ * the FSK is 1200 baud, mark (1) at 1200 Hz and space
+ * (0) at 2200 Hz, sent as bytes with a start and a stop
+ * bit.  each sample is correlated with both tones over
+ * the last FSK_L samples and the stronger one is the
+ * bit.  a bit is read from the sum of mark less space
+ * over the 3 samples at its middle.  a bit is 6 2/3 samples, so the bit
+ * clock counts in thirds of a sample.
+ *
+ * it runs on the samples decode() has converted for
+ * the detector, so with -c a channel gets caller ID
+ * and DTMF from the one pass.
+ */
+#define FSK_MARK   1200
+#define FSK_SPACE  2200
+#define FSK_BIT    20          /* thirds of a sample, 8000/1200 */
+#define FSK_MIN    0.01        /* min. power of the stronger tone */
+#define FSK_IDLE   40          /* samples of mark before a message */
+#define CID_SDMF   0x04        /* single data message */
+#define CID_MDMF   0x80        /* multiple data message */
+
+float fsk_tab[4][FSK_TAB];     /* cos, sin of mark then of space */
+
+fsk_init()
+{
+  int i;
+
+  for(i=0; i<FSK_TAB; i++) {
+    fsk_tab[0][i] = cos(2*M_PI*FSK_MARK*i/FSAMPLE);
+    fsk_tab[1][i] = sin(2*M_PI*FSK_MARK*i/FSAMPLE);
+    fsk_tab[2][i] = cos(2*M_PI*FSK_SPACE*i/FSAMPLE);
+    fsk_tab[3][i] = sin(2*M_PI*FSK_SPACE*i/FSAMPLE);
+  }
+  return(0);
+}
+
+/*
+ * append n bytes of p to the text of fp, as a field.
+ * quotes and backslashes go as '?', like the unprintable,
+ * so the text can go into JSON as it is.
+ */
+cid_field(fp, p, n)
+struct fsk *fp;
+unsigned char *p;
+int n;
+{
+  char *t = fp->text + strlen(fp->text);
+  char *end = fp->text + CID_TEXT - 1;
+
+  if(t > fp->text && t < end)
+    *t++ = ' ';
+  for(; n > 0 && t < end; n--, p++)
+    *t++ = (*p >= ' ' && *p < 0177 && *p != '"' && *p != '\\')? *p: '?';
+  *t = '\0';
+  return(0);
+}
+
+/*
+ * a message with a good checksum, to text as
+ * "MMDDHHMM number name", what is missing left out.
+ * 'O' and 'P' stand for a number or name that is
+ * out of area or private.
+ */
+cid_text(fp)
+struct fsk *fp;
+{
+  unsigned char *p = fp->msg + 2, *end = p + fp->len;
+
+  fp->text[0] = '\0';
+  if(fp->msg[0] == CID_SDMF) {
+    cid_field(fp, p, (fp->len < 8)? fp->len: 8);
+    if(fp->len > 8)
+      cid_field(fp, p + 8, fp->len - 8);
+  } else
+    for(; p + 2 <= end && p + 2 + p[1] <= end; p += 2 + p[1])
+      switch(p[0]) {
+        case 0x01:       /* date and time */
+        case 0x02:       /* number */
+        case 0x04:       /* why there is no number */
+        case 0x07:       /* name */
+        case 0x08:       /* why there is no name */
+          cid_field(fp, p + 2, p[1]);
+          break;
+      }
+  fp->ready = 1;
+  return(0);
+}
+
+/*
+ * the next byte c of the FSK, after 'idle' samples
+ * of mark.  a message is the type, the length, that
+ * many bytes and a checksum, the channel seizure and
+ * anything else before it is passed over.
+ */
+fsk_byte(fp, c, idle, at)
+struct fsk *fp;
+int c, idle;
+long at;
+{
+  switch(fp->state) {
+    case 0:
+      if(idle < FSK_IDLE || (c != CID_SDMF && c != CID_MDMF))
+        return(0);
+      fp->msg[0] = fp->check = c;
+      fp->start = at;
+      fp->state = 1;
+      break;
+    case 1:
+      fp->msg[1] = fp->len = c;
+      fp->check += c;
+      fp->n = 0;
+      fp->state = c? 2: 3;
+      break;
+    case 2:
+      fp->msg[2 + fp->n++] = c;
+      fp->check += c;
+      if(fp->n == fp->len)
+        fp->state = 3;
+      break;
+    case 3:
+      if(((fp->check + c) & 0xff) == 0)
+        cid_text(fp);
+      fp->state = 0;
+      break;
+  }
+  return(0);
+}
+
+/*
+ * demodulate the N samples x[0], x[stride], ... of
+ * a frame of channel dp
+ *
+ * the bit being received is -2 waiting for a start
+ * bit, -1 in one, 0 to 7 a data bit and 8 the stop
+ * bit.  a byte without its stop bit drops the message.
+ */
+fsk_demod(dp, x, stride)
+struct detector *dp;
+float *x;
+int stride;
+{
+  struct fsk *fp = &dp->fsk;
+  float in,p,m,s;
+  int i,j,b;
+
+  for(j=0; j<4; j++)     /* no drift in the running sums */
+    for(i=0, fp->sum[j]=0.0; i<FSK_L; i++)
+      fp->sum[j] += fp->prod[j][i];
+  for(i=0; i<N; i++) {
+    in = x[i * stride];
+    for(j=0; j<4; j++) {
+      p = in * fsk_tab[j][fp->ph];
+      fp->sum[j] += p - fp->prod[j][fp->pos];
+      fp->prod[j][fp->pos] = p;
+    }
+    if(++fp->pos == FSK_L)
+      fp->pos = 0;
+    if(++fp->ph == FSK_TAB)
+      fp->ph = 0;
+    m = fp->sum[0] * fp->sum[0] + fp->sum[1] * fp->sum[1];
+    s = fp->sum[2] * fp->sum[2] + fp->sum[3] * fp->sum[3];
+    fp->clock += 3;
+    if(m < FSK_MIN && s < FSK_MIN) {   /* no carrier */
+      fp->mark = 0;
+      if(fp->bit >= 0)
+        fp->state = 0;
+      fp->bit = -2;
+      continue;
+    }
+    b = m > s;
+    fp->d[2] = fp->d[1];
+    fp->d[1] = fp->d[0];
+    fp->d[0] = m - s;
+    if(fp->bit == -2) {
+      if(b)
+        fp->mark++;
+      else {             /* the edge of a start bit */
+        fp->bit = -1;
+        fp->next = fp->clock + FSK_BIT/2 + 3;
+      }
+      continue;
+    }
+    if(fp->clock < fp->next)
+      continue;
+    fp->next += FSK_BIT;
+    b = fp->d[0] + fp->d[1] + fp->d[2] > 0.0;
+    if(fp->bit == -1) {
+      if(b)              /* a glitch, still idle */
+        fp->bit = -2;
+      else {
+        fp->bit = 0;
+        fp->idle = fp->mark;
+        fp->mark = 0;
+        fp->byte = 0;
+      }
+    } else if(fp->bit < 8)
+      fp->byte |= b << fp->bit++;
+    else {
+      if(b)
+        fsk_byte(fp, fp->byte, fp->idle, dp->nframe * N + i);
+      else
+        fp->state = 0;
+      fp->bit = -2;
+    }
+  }
+  return(0);
+}
+
+/*
+ * decode the N samples in x, of the energy and
+ * pre-screen energy given, see frame_energy
+ */
+decode_frame(dp,x,energy,pre)
+struct detector *dp;
+float *x;
+float energy, pre;
+{
+  struct profile *pp = dp->prof;
+  float power[NUMBANK],maxpower;
+  float u0[NUMBANK],u1[NUMBANK];
+  int i;
+  M_VAR(t);
+  
+  CNT->frames++;
+  dp->peak[0] = dp->peak[1] = 0.0;
+  if(dp->callerid)
+    fsk_demod(dp,x,1);
+  if(energy < dp->gate) {    /* silence, without a single resonator */
+    CNT->gated++;
+    return(DSIL);
+  }
+  for(i=0; i<NUMBANK; i++) {
+    u0[i] = 0.0;
+    u1[i] = 0.0;
+    power[i] = 0.0;
+  }
+  M_START(t);
+  PROBE2(power_start, dp->chan, 1);
+  (*pp->resonate)(x,0,PRE_N,u0,u1);
+#ifdef PRESCREEN
+  if(pre >= dp->gate) {  /* else the tone, if any, starts later */
+    (*pp->power)(u0,u1,power);
+    for(i=0, maxpower=0.0; i<pp->ntones; i++)
+      if(power[pp->tones[i]] > maxpower)
+        maxpower = power[pp->tones[i]];
+    if(maxpower < PRE_RATIO * PRE_N * pre) {  /* nothing tonal */
+      CNT->screened++;
+      PROBE2(power_end, dp->chan, 0);
+      /* a steady tone grows as the square of the block length,
+       * report it the way the full bank would have
+       */
+      if(maxpower * N * N < dp->thresh * PRE_N * PRE_N)
+        return(DSIL);
+      return(-1);
+    }
+  }
+#endif
+  (*pp->resonate)(x,PRE_N,N,u0,u1);
+  (*pp->power)(u0,u1,power);
+  M_KERNEL(pp - profiles, t, 1);
+  PROBE2(power_end, dp->chan, 1);
+  CNT->bank++;
+  if(pp->phase >= 0)
+    phasor(pp->tones[pp->phase],u0[pp->phase],u1[pp->phase],dp->z);
+  set_peaks(dp,power);
+  return((*pp->classify)(dp,power));
+}
+
+/*
+ * detect which signals are present on the
+ * channel 'dp' in the frame 'data'
+ *
+ * returns the classification of the channel's
+ * profile, see classify_full
+ */
+decode(dp,data)
+struct detector *dp;
+char *data;
+{
+  float x[N],energy,pre,t = dp->thresh;
+  int r;
+
+  energy = frame_energy(data,x,&pre);
+  r = level_frame(dp,decode_frame(dp,x,energy,pre),energy);
+  PROBE2(decode_result, dp->chan, r);
+  if(dp->dump)
+    spec_frame(dp,x,r,t);
+  return(r);
+}
+
+/*
+ * decode(), for a frame already in floats from -1.0
+ * to 1.0, as any other sample format can be had
+ */
+decode_float(dp,x)
+struct detector *dp;
+float *x;
+{
+  float e,pre,t = dp->thresh;
+  int i,r;
+
+  for(i=0, e=0.0; i<N; i++) {
+    e += x[i] * x[i];
+    if(i == PRE_N-1)
+      pre = e;
+  }
+  r = level_frame(dp,decode_frame(dp,x,e,pre),e);
+  PROBE2(decode_result, dp->chan, r);
+  if(dp->dump)
+    spec_frame(dp,x,r,t);
+  return(r);
+}
+
+/*
+ * multi channel batches.
+ *
+ * a batch holds one frame of up to NCHAN channels laid
+ * out sample major (x[i][c] is sample i of channel c),
+ * and the goertzel state is kept the same way, so one
+ * pass over the samples advances every channel, one
+ * SIMD lane per channel.  the frames come in channel
+ * by channel and are transposed by batch_ingest().
+ */
+
+/*
+ * transpose the N samples of 'data' into lane c
+ * of the batch, data 0 is a lane with no input
+ * (it is left out of the stage counts)
+ */
+batch_ingest(bp,c,data)
+struct batch *bp;
+int c;
+#ifdef UNSIGNED
+unsigned char *data;
+#else
+char *data;
+#endif
+{
+  float e,in;
+  int i;
+
+  for(i=0, e=0.0; i<N; i++) {
+    in = data ? SAMPLE_TO_FLOAT(data[i]) : 0.0;
+    bp->x[i][c] = in;
+    e += in * in;
+    if(i == PRE_N-1)
+      bp->pre[c] = e;
+  }
+  bp->energy[c] = data ? e : -1.0;
+  return(0);
+}
+
+/*
+ * run the resonators in u0,u1 over samples 'from'
+ * up to 'to' of the first bp->lanes lanes of the batch,
+ * with the kernel det_tune() picked
+ */
+batch_resonate(bp,from,to,u0,u1)
+struct batch *bp;
+int from, to;
+float u0[][NCHAN], u1[][NCHAN];
+{
+  return((*the_kernel->resonate)(bp,from,to,u0,u1));
+}
+
+/*
+ * the batch kernels.
+ *
+ * plain is sample major, all NCHAN lanes a sample, and
+ * left to the compiler to vectorize.  the others are
+ * tone major: four tones of a group of lanes are run
+ * through the whole frame with their state in registers,
+ * so the only loads are the samples, and the four
+ * chains hide each other's latency.  sse, avx and
+ * avx512 have 4, 8 and 16 lanes a register; avx and
+ * avx512 are compiled for their instructions whatever
+ * the flags, and used only if the CPU has them.  each
+ * does the arithmetic in the same order as plain, and
+ * NOFMA, on plain too, keeps the compiler from fusing
+ * the multiply and add whatever -march says, so all of
+ * them give the same bits and det_tune() can hold them
+ * to it.
+ */
+#define NOFMA  optimize("fp-contract=off")
+
+__attribute__((NOFMA)) plain_resonate(bp,from,to,u0,u1)
+struct batch *bp;
+int from, to;
+float u0[][NCHAN], u1[][NCHAN];
+{
+  float c,t;
+  int i,j,l;
+
+  for(i=from; i<to; i++)     /* feedback */
+    for(j=0; j<bp->ntones; j++) {
+      c = coef[bp->tones[j]];
+      for(l=0; l<NCHAN; l++) {
+        t = u0[j][l];
+        u0[j][l] = bp->x[i][l] + c * u0[j][l] - u1[j][l];
+        u1[j][l] = t;
+      }
+    }
+  return(0);
+}
+
+/*
+ * TONE_MAJOR(name,V,W,...) expands a tone major kernel
+ * for vectors of type V, W lanes wide, given its load,
+ * store, set1, add, sub and mul
+ */
+#define TONE_MAJOR(name,attr,V,W,LD,ST,SET,ADD,SUB,MUL)           \
+attr name##_resonate(bp,from,to,u0,u1)                            \
+struct batch *bp;                                                 \
+int from, to;                                                     \
+float u0[][NCHAN], u1[][NCHAN];                                   \
+{                                                                 \
+  V c[4],a0[4],a1[4],t,in;                                        \
+  int i,j,l,m,n;                                                  \
+                                                                  \
+  for(l=0; l<bp->lanes; l+=W)                                     \
+    for(j=0; j<bp->ntones; j+=n) {                                \
+      n = (bp->ntones-j < 4)? bp->ntones-j: 4;                    \
+      for(m=0; m<n; m++) {                                        \
+        c[m] = SET(coef[bp->tones[j+m]]);                         \
+        a0[m] = LD(&u0[j+m][l]);                                  \
+        a1[m] = LD(&u1[j+m][l]);                                  \
+      }                                                           \
+      if(n == 4)             /* the usual case, unrolled */       \
+        for(i=from; i<to; i++) {                                  \
+          in = LD(&bp->x[i][l]);                                  \
+          t = a0[0];  a0[0] = SUB(ADD(in, MUL(c[0], t)), a1[0]);  a1[0] = t; \
+          t = a0[1];  a0[1] = SUB(ADD(in, MUL(c[1], t)), a1[1]);  a1[1] = t; \
+          t = a0[2];  a0[2] = SUB(ADD(in, MUL(c[2], t)), a1[2]);  a1[2] = t; \
+          t = a0[3];  a0[3] = SUB(ADD(in, MUL(c[3], t)), a1[3]);  a1[3] = t; \
+        }                                                         \
+      else                                                        \
+        for(i=from; i<to; i++) {                                  \
+          in = LD(&bp->x[i][l]);                                  \
+          for(m=0; m<n; m++) {                                    \
+            t = a0[m];                                            \
+            a0[m] = SUB(ADD(in, MUL(c[m], t)), a1[m]);            \
+            a1[m] = t;                                            \
+          }                                                       \
+        }                                                         \
+      for(m=0; m<n; m++) {                                        \
+        ST(&u0[j+m][l], a0[m]);                                   \
+        ST(&u1[j+m][l], a1[m]);                                   \
+      }                                                           \
+    }                                                             \
+  return(0);                                                      \
+}
+
+#ifdef __SSE__
+TONE_MAJOR(sse, __attribute__((NOFMA)), __m128, 4, _mm_loadu_ps, _mm_storeu_ps, _mm_set1_ps,
+           _mm_add_ps, _mm_sub_ps, _mm_mul_ps)
+#endif
+#ifdef X86_KERNELS
+TONE_MAJOR(avx, __attribute__((target("avx"), NOFMA)), __m256, 8,
+           _mm256_loadu_ps, _mm256_storeu_ps, _mm256_set1_ps,
+           _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps)
+#if NCHAN >= 16
+TONE_MAJOR(avx512, __attribute__((target("avx512f"), NOFMA)), __m512, 16,
+           _mm512_loadu_ps, _mm512_storeu_ps, _mm512_set1_ps,
+           _mm512_add_ps, _mm512_sub_ps, _mm512_mul_ps)
+#endif
+#endif
+
+/* plain first, the reference and the default */
+struct kernel kernels[] = {
+  { "plain", plain_resonate, NCHAN },
+#ifdef __SSE__
+  { "sse", sse_resonate, 4 },
+#endif
+#ifdef X86_KERNELS
+  { "avx", avx_resonate, 8 },
+#if NCHAN >= 16
+  { "avx512", avx512_resonate, 16 },
+#endif
+#endif
+  { 0 } };
+
+struct kernel *the_kernel = &kernels[0];
+int batch_lanes = NCHAN;
+char *tune_from = "default";
+
+/*
+ * the tuner.
+ *
+ * det_tune() times every kernel the CPU can run at
+ * every batch width, 4 channels and up by doubling to
+ * NCHAN, over the full profile's tones, and keeps the
+ * least time a channel frame; a narrower batch has to
+ * be TUNE_GAIN faster to be taken, it costs more batches.
+ * a kernel that does not give the same bits as plain
+ * on a test batch is never used.  the choice is kept
+ * in the cache file by host, the CPU's name, the
+ * features the kernels need and NCHAN, so a home shared
+ * by a mixed fleet holds a line for each kind of host,
+ * and the next run only checks it.
+ */
+#define TUNE_NS    2000000       /* a timing, at least */
+#define TUNE_GAIN  0.95
+#define TUNE_LINE  256
+
+/* can the CPU run kernel kp */
+kernel_usable(kp)
+struct kernel *kp;
+{
+#ifdef X86_KERNELS
+  __builtin_cpu_init();
+  if(!strcmp(kp->name, "avx"))
+    return(__builtin_cpu_supports("avx"));
+  if(!strcmp(kp->name, "avx512"))
+    return(__builtin_cpu_supports("avx512f"));
+#endif
+  return(1);
+}
+
+/* this kind of host, for the cache */
+tune_host(buf, size)
+char *buf;
+int size;
+{
+  char line[TUNE_LINE], *p, *model = "unknown";
+  struct kernel *kp;
+  FILE *fp;
+  int n;
+
+  line[0] = '\0';
+  if((fp = fopen("/proc/cpuinfo", "r"))) {
+    while(fgets(line, sizeof(line), fp))
+      if(!strncmp(line, "model name", 10) && (p = strchr(line, ':'))) {
+        for(model=p+1; *model == ' '; model++)
+          ;
+        model[strcspn(model, "\t\n")] = '\0';
+        break;
+      }
+    fclose(fp);
+  }
+  n = snprintf(buf, size, "%s nchan=%d", model, NCHAN);
+  for(kp=kernels; kp->name && n < size; kp++)
+    if(kernel_usable(kp))
+      n += snprintf(buf+n, size-n, " %s", kp->name);
+  return(0);
+}
+
+/* a batch of noise and tones in every lane, the tones of 'full' */
+tune_batch(bp)
+struct batch *bp;
+{
+  struct profile *pp = find_profile("full");
+  unsigned seed = 1;
+  int i,l;
+
+  for(i=0; i<N; i++)
+    for(l=0; l<NCHAN; l++) {
+      seed = seed * 1103515245 + 12345;
+      bp->x[i][l] = ((seed >> 16) & 0x7fff) / 65536.0 - 0.25 +
+                    0.5 * sin(2 * M_PI * i * k[(l*5) % NUMTONES] / N);
+    }
+  bp->nchan = NCHAN;
+  bp->ntones = pp->nbank;
+  for(i=0; i<pp->nbank; i++)
+    bp->tones[i] = pp->tones[i];
+  return(0);
+}
+
+/* the resonators of bp, run from 0 by kernel kp */
+tune_run(kp, bp, u0, u1)
+struct kernel *kp;
+struct batch *bp;
+float u0[][NCHAN], u1[][NCHAN];
+{
+  memset(u0, 0, NUMBANK * NCHAN * sizeof(float));
+  memset(u1, 0, NUMBANK * NCHAN * sizeof(float));
+  (*kp->resonate)(bp,0,N,u0,u1);
+  return(0);
+}
+
+/* does kp give the bits plain does, lanes up to bp->lanes */
+kernel_agrees(kp, bp)
+struct kernel *kp;
+struct batch *bp;
+{
+  float r0[NUMBANK][NCHAN], r1[NUMBANK][NCHAN];
+  float u0[NUMBANK][NCHAN], u1[NUMBANK][NCHAN];
+  int j;
+
+  tune_run(&kernels[0], bp, r0, r1);
+  tune_run(kp, bp, u0, u1);
+  for(j=0; j<bp->ntones; j++)
+    if(memcmp(u0[j], r0[j], bp->lanes * sizeof(float)) ||
+       memcmp(u1[j], r1[j], bp->lanes * sizeof(float)))
+      return(0);
+  return(1);
+}
+
+/* the lanes kernel kp runs for a batch of width channels */
+kernel_lanes(kp, width)
+struct kernel *kp;
+int width;
+{
+  width = (width + kp->step-1) / kp->step * kp->step;
+  return((width > NCHAN)? NCHAN: width);
+}
+
+/* ns a channel frame of kernel kp, width channels a batch */
+double kernel_time(kp, bp, width)
+struct kernel *kp;
+struct batch *bp;
+int width;
+{
+  float u0[NUMBANK][NCHAN], u1[NUMBANK][NCHAN];
+  long t, best = -1, reps, r;
+  int pass;
+
+  bp->lanes = kernel_lanes(kp, width);
+  for(pass=0; pass<3; pass++) {    /* the best of three */
+    t = now_ns();
+    for(reps=0; now_ns() - t < TUNE_NS; reps += 16)
+      for(r=0; r<16; r++)
+        tune_run(kp, bp, u0, u1);
+    t = (now_ns() - t) / reps;
+    if(best < 0 || t < best)
+      best = t;
+  }
+  return((double)best / width);
+}
+
+/* the cached choice for host, 1 if there is one it can use */
+tune_load(cache, host, bp)
+const char *cache;
+char *host;
+struct batch *bp;
+{
+  char line[TUNE_LINE], name[32];
+  struct kernel *kp;
+  FILE *fp;
+  int n = strlen(host), lanes, found = 0;
+  double ns;
+
+  if(!cache || !(fp = fopen(cache, "r")))
+    return(0);
+  while(!found && fgets(line, sizeof(line), fp))
+    found = !strncmp(line, host, n) && line[n] == '\t' &&
+            sscanf(line+n+1, "%31s %d %lf", name, &lanes, &ns) == 3;
+  fclose(fp);
+  if(!found)
+    return(0);
+  for(kp=kernels; kp->name && strcmp(kp->name, name); kp++)
+    ;
+  if(!kp->name || !kernel_usable(kp) || lanes < 4 || lanes > NCHAN ||
+     lanes & (lanes-1))
+    return(0);
+  bp->lanes = kernel_lanes(kp, lanes);
+  if(!kernel_agrees(kp, bp))
+    return(0);
+  kp->ns = ns;
+  the_kernel = kp;
+  batch_lanes = lanes;
+  return(1);
+}
+
+/* put the choice for host in the cache, in place of the old one */
+tune_save(cache, host)
+const char *cache;
+char *host;
+{
+  char line[TUNE_LINE], tmp[1024];
+  FILE *in, *out;
+  int n = strlen(host);
+
+  snprintf(tmp, sizeof(tmp), "%s.%d", cache, (int)getpid());
+  if(!(out = fopen(tmp, "w")))
+    return(-1);
+  if((in = fopen(cache, "r"))) {
+    while(fgets(line, sizeof(line), in))
+      if(strncmp(line, host, n) || line[n] != '\t')
+        fputs(line, out);
+    fclose(in);
+  }
+  fprintf(out, "%s\t%s %d %.1f\n", host, the_kernel->name, batch_lanes,
+          the_kernel->ns);
+  if(fclose(out) == EOF || rename(tmp, cache) < 0) {
+    unlink(tmp);
+    return(-1);
+  }
+  return(0);
+}
+
+/*
+ * pick the batch kernel and width for this host, from
+ * 'cache' if it has them (and force is 0), else by
+ * timing them, and keep them there.  cache 0 keeps
+ * nothing.  verbose puts the timings on stderr.
+ *
+ * returns -1 if the choice could not be kept
+ */
+det_tune(cache, force, verbose)
+const char *cache;
+int force, verbose;
+{
+  struct batch b;
+  struct kernel *kp;
+  char host[TUNE_LINE];
+  double ns, best = 0.0;
+  int w;
+
+  tune_host(host, sizeof(host));
+  tune_batch(&b);
+  if(!force && tune_load(cache, host, &b)) {
+    tune_from = "cache";
+    return(0);
+  }
+  the_kernel = &kernels[0];
+  batch_lanes = NCHAN;
+  for(kp=kernels; kp->name; kp++) {
+    kp->ns = 0.0;
+    b.lanes = NCHAN;
+    if(!(kp->usable = kernel_usable(kp)) ||
+       !(kp->agrees = kernel_agrees(kp, &b))) {
+      if(verbose)
+        fprintf(stderr, "kernel %-7s %s\n", kp->name,
+                kp->usable? "disagrees, not used": "not on this CPU");
+      continue;
+    }
+    for(w=NCHAN; w>=4; w/=2) {
+      ns = kernel_time(kp, &b, w);
+      if(verbose)
+        fprintf(stderr, "kernel %-7s %2d lanes  %7.1f ns a channel frame\n",
+                kp->name, w, ns);
+      if(!best || ns < best * ((w < batch_lanes)? TUNE_GAIN: 1.0)) {
+        best = ns;
+        kp->ns = ns;
+        the_kernel = kp;
+        batch_lanes = w;
+      }
+    }
+  }
+  tune_from = "tuned";
+  if(verbose)
+    fprintf(stderr, "kernel %s, %d lanes\n", the_kernel->name, batch_lanes);
+  if(cache && tune_save(cache, host) < 0)
+    return(-1);
+  return(0);
+}
+
+/*
+ * use kernel 'spec', "name" or "name,lanes", instead
+ * of tuning.  -1 if there is no such kernel for this
+ * CPU, or it disagrees
+ */
+set_kernel(spec)
+const char *spec;
+{
+  struct batch b;
+  struct kernel *kp;
+  const char *p = strchr(spec, ',');
+  int n = p? p - spec: strlen(spec), lanes = p? atoi(p+1): NCHAN;
+
+  for(kp=kernels; kp->name; kp++)
+    if(strlen(kp->name) == n && !strncmp(kp->name, spec, n))
+      break;
+  if(!kp->name || !kernel_usable(kp) || lanes < 4 || lanes > NCHAN ||
+     lanes & (lanes-1))
+    return(-1);
+  tune_batch(&b);
+  b.lanes = kernel_lanes(kp, lanes);
+  if(!kernel_agrees(kp, &b))
+    return(-1);
+  the_kernel = kp;
+  batch_lanes = lanes;
+  tune_from = "set";
+  return(0);
+}
+
+batch_power(bp,u0,u1,power)
+struct batch *bp;
+float u0[][NCHAN], u1[][NCHAN], power[][NUMBANK];
+{
+  float c;
+  int j,l;
+
+  for(j=0; j<bp->ntones; j++) {    /* feedforward */
+    c = coef[bp->tones[j]];
+    for(l=0; l<bp->lanes; l++)
+      power[l][bp->tones[j]] = 
+        u0[j][l] * u0[j][l] + u1[j][l] * u1[j][l] - c * u0[j][l] * u1[j][l];
+  }
+  return(0);
+}
+
+/*
+ * decode every lane of the batch, the same way
+ * decode() would.  dp[c] is the channel in lane c,
+ * its result goes to x[c].
+ */
+batch_decode(bp,dp,x)
+struct batch *bp;
+struct detector *dp;
+int *x;
+{
+  float f[N],t;
+  int i,c;
+
+  batch_classify(bp,dp,x);
+  for(c=0; c<bp->nchan; c++) {
+    if(bp->energy[c] < 0.0)      /* no input */
+      continue;
+    t = dp[c].thresh;
+    x[c] = level_frame(&dp[c],x[c],bp->energy[c]);
+    PROBE2(decode_result, dp[c].chan, x[c]);
+    if(dp[c].dump) {
+      for(i=0; i<N; i++)
+        f[i] = bp->x[i][c];
+      spec_frame(&dp[c],f,x[c],t);
+    }
+  }
+  return(0);
+}
+
+/* batch_decode(), but for the levels and the dump */
+batch_classify(bp,dp,x)
+struct batch *bp;
+struct detector *dp;
+int *x;
+{
+  float u0[NUMBANK][NCHAN],u1[NUMBANK][NCHAN];
+  float power[NCHAN][NUMBANK],maxpower;
+  int on[NUMBANK],live[NCHAN],nlive,i,j,c;
+  struct profile *pp;
+  M_VAR(t);
+
+  for(i=0; i<NUMBANK; i++)
+    on[i] = 0;
+  for(c=0, nlive=0; c<bp->nchan; c++) {
+    dp[c].peak[0] = dp[c].peak[1] = 0.0;
+    if(dp[c].callerid && bp->energy[c] >= 0.0)
+      fsk_demod(&dp[c],&bp->x[0][c],NCHAN);
+    live[c] = bp->energy[c] >= dp[c].gate;
+    if(!live[c]) {
+      if(bp->energy[c] >= 0.0) {
+        CNT->frames++;
+        CNT->gated++;
+      }
+      x[c] = DSIL;
+      continue;
+    }
+    CNT->frames++;
+    nlive++;
+    pp = dp[c].prof;
+    for(i=0; i<pp->nbank; i++)
+      on[pp->tones[i]] = 1;
+  }
+  if(!nlive)             /* the whole batch is silent */
+    return(0);
+  for(i=0, bp->ntones=0; i<NUMBANK; i++)
+    if(on[i])
+      bp->tones[bp->ntones++] = i;
+  for(c=bp->nchan; c<NCHAN; c++)
+    live[c] = 0;
+  bp->lanes = kernel_lanes(the_kernel, bp->nchan);
+  for(c=0; c<NCHAN; c++)
+    for(i=0; i<NUMBANK; i++) {
+      u0[i][c] = 0.0;
+      u1[i][c] = 0.0;
+      power[c][i] = 0.0;
+    }
+
+  M_START(t);
+  PROBE2(power_start, dp[0].chan, nlive);
+  batch_resonate(bp,0,PRE_N,u0,u1);
+#ifdef PRESCREEN
+  batch_power(bp,u0,u1,power);
+  for(c=0; c<bp->nchan; c++) {
+    if(!live[c] || bp->pre[c] < dp[c].gate)
+      continue;
+    pp = dp[c].prof;
+    for(i=0, maxpower=0.0; i<pp->ntones; i++)
+      if(power[c][pp->tones[i]] > maxpower)
+        maxpower = power[c][pp->tones[i]];
+    if(maxpower < PRE_RATIO * PRE_N * bp->pre[c]) {   /* see decode() */
+      CNT->screened++;
+      x[c] = (maxpower * N * N < dp[c].thresh * PRE_N * PRE_N) ? DSIL : -1;
+      live[c] = 0;
+      nlive--;
+    }
+  }
+  if(!nlive) {
+    PROBE2(power_end, dp[0].chan, 0);
+    return(0);
+  }
+#endif
+  batch_resonate(bp,PRE_N,N,u0,u1);
+  batch_power(bp,u0,u1,power);
+  M_KERNEL(K_BATCH, t, nlive);
+  PROBE2(power_end, dp[0].chan, nlive);
+  for(c=0; c<bp->nchan; c++) {
+    if(!live[c])
+      continue;
+    CNT->bank++;
+    pp = dp[c].prof;
+    if(pp->phase >= 0) {
+      for(j=0; bp->tones[j] != pp->tones[pp->phase]; j++)
+        ;
+      phasor(bp->tones[j],u0[j][c],u1[j][c],dp[c].z);
+    }
+    set_peaks(&dp[c],power[c]);
+    x[c] = (*dp[c].prof->classify)(&dp[c],power[c]);
+  }
+  return(0);
+}
+
+/*
+ * levels.
+ *
+ * THRESH and RANGE are where a channel starts, struct
+ * levels can set others at run time, and more checks.
+ *
+ * the noise floor of a channel is the energy of its
+ * frames that are not a tone, followed down quickly and
+ * up slowly so speech lifts it little (for white noise a
+ * bin's power is about the frame's energy).  with adapt
+ * the threshold is kept that many dB over the floor, but
+ * not under ADAPT_MIN of thresh nor over ADAPT_TONE of
+ * the tones the line has had, so a hot line needs louder
+ * tones and a quiet one less loud.  it is a step on two
+ * numbers a frame.
+ *
+ * on DTMF digits twist is the most the row may be over
+ * the column, rtwist the column over the row, in dB.
+ * share and harm are the talk-off checks, on unless set
+ * to 0: share is the least of the frame's energy the two
+ * tones must hold (a tone's power is N/2 times its
+ * energy, the energy comes from the loop that converts
+ * the samples), and harm the most either tone's second
+ * harmonic may have of its power.  a voice is a pitch
+ * and its harmonics, so speech that happens to put two
+ * of them on a row and a column puts power on their
+ * harmonics and between them too, a DTMF generator does
+ * not.  the harmonics are resonators of the profile's
+ * kernel, run in the same loop as its tones.  0 is no
+ * check.
+ */
+#define ADAPT_MIN   (1/16.0)
+#define ADAPT_TONE  0.25
+#define FLOOR_UP    (1/64.0)    /* weights of a frame */
+#define FLOOR_DOWN  0.25
+#define LEVEL_W     0.125
+
+/* THRESH and RANGE and the talk-off checks */
+void levels_init(lv)
+struct levels *lv;
+{
+  lv->thresh = THRESH;
+  lv->range = RANGE;
+  lv->adapt = 0.0;
+  lv->twist = lv->rtwist = 0.0;
+  lv->share = SHARE;
+  lv->harm = HARM;
+}
+
+/*
+ * set levels from 'spec', name=value,... as in
+ * "adapt=20,twist=8,share=0.5".  returns -1 if
+ * it is not one
+ */
+levels_parse(lv, spec)
+struct levels *lv;
+const char *spec;
+{
+  static char *names[] = { "thresh", "range", "adapt", "twist", "rtwist",
+                           "share", "harm", 0 };
+  float *v[7];
+  char *end;
+  int i,n;
+
+  v[0] = &lv->thresh;  v[1] = &lv->range;  v[2] = &lv->adapt;
+  v[3] = &lv->twist;  v[4] = &lv->rtwist;  v[5] = &lv->share;
+  v[6] = &lv->harm;
+  while(*spec) {
+    for(i=0; names[i]; i++) {
+      n = strlen(names[i]);
+      if(!strncmp(spec, names[i], n) && spec[n] == '=')
+        break;
+    }
+    if(!names[i])
+      return(-1);
+    *v[i] = strtod(spec + n + 1, &end);
+    if(end == spec + n + 1 || (*end && *end != ','))
+      return(-1);
+    spec = *end? end + 1: end;
+  }
+  if(lv->thresh <= 0.0 || lv->range <= 0.0 || lv->range >= 1.0 ||
+     lv->adapt < 0.0 || lv->twist < 0.0 || lv->rtwist < 0.0 ||
+     lv->share < 0.0 || lv->share > 1.0 || lv->harm < 0.0)
+    return(-1);
+  return(0);
+}
+
+/* decode channel dp at levels lv, from now */
+void det_levels(dp, lv)
+struct detector *dp;
+struct levels *lv;
+{
+  dp->lv = *lv;
+  dp->over = pow(10.0, lv->adapt / 10);
+  dp->tw = pow(10.0, lv->twist / 10);
+  dp->rtw = pow(10.0, lv->rtwist / 10);
+  dp->floor = lv->thresh / dp->over;
+  dp->level = 0.0;
+  dp->thresh = lv->thresh;
+  dp->gate = 0.99 * lv->thresh / N;
+}
+
+/* the two strongest tones of dp are a DTMF row and column */
+dtmf_tops(dp)
+struct detector *dp;
+{
+  int on[NUMBANK], i;
+
+  for(i=0; i<NUMBANK; i++)
+    on[i] = 0;
+  on[dp->top[0]] = on[dp->top[1]] = 1;
+  return(dtmf_pair(on) >= 0);
+}
+
+/*
+ * the checks and the levels for the result x of a
+ * frame of channel dp, of energy e.  the DTMF checks
+ * are only for a DTMF pair, not MF digits, of the mf
+ * profile or before KP in full.
+ *
+ * returns x, or -1 if a check failed
+ */
+level_frame(dp, x, e)
+struct detector *dp;
+int x;
+float e;
+{
+  struct levels *lv = &dp->lv;
+  float pr, pc, t;
+  int row;
+
+  if(x >= 0 && x < DC11 && !dp->MFmode &&
+     (lv->twist > 0.0 || lv->rtwist > 0.0 || lv->share > 0.0 ||
+      lv->harm > 0.0) && has_dtmf(dp->prof) && dtmf_tops(dp)) {
+    row = dp->top[0] == R1 || dp->top[0] == R2 || dp->top[0] == R3 ||
+          dp->top[0] == R4;
+    pr = dp->peak[!row];
+    pc = dp->peak[row];
+    if((lv->twist > 0.0 && pr > dp->tw * pc) ||
+       (lv->rtwist > 0.0 && pc > dp->rtw * pr) ||
+       2 * (pr + pc) < lv->share * N * e ||
+       (lv->harm > 0.0 && (dp->hp[0] > lv->harm * dp->peak[0] ||
+                           dp->hp[1] > lv->harm * dp->peak[1]))) {
+      CNT->rejected++;
+      x = -1;
+    }
+  }
+  if(lv->adapt <= 0.0)
+    return(x);
+  if(x < 0 || x == DSIL)
+    dp->floor += ((e > dp->floor)? FLOOR_UP: FLOOR_DOWN) * (e - dp->floor);
+  else
+    dp->level = dp->level? dp->level + LEVEL_W * (dp->peak[0] - dp->level):
+                           dp->peak[0];
+  t = dp->over * dp->floor;
+  if(t < ADAPT_MIN * lv->thresh)
+    t = ADAPT_MIN * lv->thresh;
+  if(dp->level && t > ADAPT_TONE * dp->level)
+    t = ADAPT_TONE * dp->level;
+  dp->thresh = t;
+  dp->gate = 0.99 * t / N;
+  return(x);
+}
+
+/*
+ * the power dump.
+ *
+ * with a dump the power of the classic bank's tones in
+ * every frame, and the frame's result and threshold, go
+ * to a file to tune RANGE and THRESH on (see power.c).  the bank is
+ * run again for it, over the whole frame whatever the
+ * profile and the cascade did, so the live path pays
+ * nothing but a test when there is no dump.  a channel
+ * fills a block of its own, made on its first frame,
+ * and a full block takes the next SPEC_SIZE of the
+ * file, so the threads never wait on each other.
+ */
+
+/* start a dump on fd, -1 if the header can not be written */
+spec_open(sf, fd)
+struct specfile *sf;
+int fd;
+{
+  struct spec_head h;
+  int i;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, "DTPW", 4);
+  h.version = SPEC_VERSION;
+  h.ntones = NUMTONES;
+  h.block = SPEC_BLOCK;
+  h.n = N;
+  h.fsample = FSAMPLE;
+  for(i=0; i<NUMTONES; i++)
+    h.k[i] = k[i];
+  sf->fd = fd;
+  sf->off = sizeof(h);
+  if(pwrite(fd, &h, sizeof(h), 0) != sizeof(h))
+    return(-1);
+  return(0);
+}
+
+/* the block of channel dp to the file */
+spec_write(dp)
+struct detector *dp;
+{
+  struct spec *sp = dp->spec;
+  long long off;
+
+  off = __sync_fetch_and_add(&dp->dump->off, (long long)SPEC_SIZE);
+  if(pwrite(dp->dump->fd, sp, SPEC_SIZE, off) != SPEC_SIZE)
+    perror("power dump");
+  sp->nframes = 0;
+  return(0);
+}
+
+/* the frame x of channel dp, of result r at threshold t */
+spec_frame(dp, x, r, t)
+struct detector *dp;
+float *x;
+int r;
+float t;
+{
+  struct spec *sp = dp->spec;
+  float power[NUMBANK];
+  int i,n;
+
+  if(!sp && !(sp = dp->spec = (struct spec *)calloc(1, sizeof(*sp)))) {
+    perror("power dump");
+    dp->dump = 0;
+    return(-1);
+  }
+  if(!sp->nframes) {
+    sp->chan = dp->chan;
+    sp->first = dp->nframe;
+    sp->range = dp->lv.range;
+  }
+  calc_power_float(x, power);
+  n = sp->nframes++;
+  for(i=0; i<NUMTONES; i++)
+    sp->power[i][n] = power[i];
+  sp->thresh[n] = t;
+  sp->result[n] = r;
+  if(sp->nframes == SPEC_BLOCK)
+    spec_write(dp);
+  return(0);
+}
+
+/* the end of channel dp's dump */
+spec_end(dp)
+struct detector *dp;
+{
+  struct spec *sp = dp->spec;
+  int i;
+
+  if(sp->nframes) {
+    for(i=0; i<NUMTONES; i++)
+      memset(&sp->power[i][sp->nframes], 0,
+             (SPEC_BLOCK - sp->nframes) * sizeof(float));
+    memset(&sp->thresh[sp->nframes], 0,
+           (SPEC_BLOCK - sp->nframes) * sizeof(float));
+    memset(&sp->result[sp->nframes], 0, SPEC_BLOCK - sp->nframes);
+    spec_write(dp);
+  }
+  free(sp);
+  dp->spec = 0;
+  return(0);
+}
+
+/*
+ * what to output for the result x of a frame of
+ * channel dp
+ *
+ * returns the code to print, DSIL for the end
+ * of a line after FLUSH_TIME frames of silence
+ * or -1 for nothing
+ */
+next_event(dp, x)
+struct detector *dp;
+int x;
+{
+  int last = dp->last, code = -1;
+
+  if(x >= 0) {
+    if(x == DSIL)
+      dp->silence_time += (dp->silence_time>=0)?1:0 ;
+    else
+      dp->silence_time= 0;
+    if(dp->silence_time == FLUSH_TIME) {
+      code = DSIL;
+      dp->silence_time= -1;   /* stop counting */
+    }
+
+    if(x != DSIL && x != last &&
+       (last == DSIL || last >= D24))  /* the tones, they are held */
+      code = x;
+    dp->last = x;
+  }
+  return(code);
+}
+
+/*
+ * call progress by cadence.
+ *
+ * follows the call progress tones in the results of a
+ * channel frame by frame, timing how long each is on and
+ * off, and decides as soon as it can:
+ *
+ *   dial tone   350+440 steady for DIAL_MIN
+ *   ringback    440+480 on for RING_MIN
+ *   busy        480+620 with an on period of about 0.5 s
+ *   reorder     480+620 with an on period of about 0.25 s
+ *   SIT         the three special information tones in turn
+ *
+ * busy and reorder are told apart by the first on period
+ * seen from its start, so the verdict comes as the tone
+ * first stops.  a verdict is given once, and again only
+ * if it changes or after FLUSH_TIME with no tone at all.
+ *
+ * 'x' is the result of the frame starting at sample 'at'.
+ * returns the verdict, or -1 for none this frame
+ */
+cp_cadence(dp, x, at)
+struct detector *dp;
+int x;
+long at;
+{
+  struct cadence *cp = &dp->cad;
+  int tone, v = -1;
+
+  if(x < 0)              /* invalid frames change nothing */
+    return(-1);
+  tone = (x == DDT || x == DRING || x == DBUSY ||
+          (x >= DSIT1 && x <= DSIT3))? x: -1;
+  if(tone >= 0 && tone == cp->tone) {
+    cp->on = (at - cp->start)/N + 1;  /* across invalid frames too */
+    if(tone == DDT && cp->on >= DIAL_MIN)
+      v = VDIAL;
+    if(tone == DRING && cp->on >= RING_MIN)
+      v = VRING;
+    if(tone == DSIT3 && cp->sit == 2 && cp->on >= 2)
+      v = VSIT;
+    cp->since = cp->start;
+  } else {
+    if(cp->tone >= 0) {  /* it stopped */
+      if(cp->tone == DBUSY && cp->had_off) {
+        if(cp->on >= BUSY_ON_MIN && cp->on <= BUSY_ON_MAX)
+          v = VBUSY;
+        else if(cp->on >= REOR_ON_MIN && cp->on <= REOR_ON_MAX)
+          v = VREOR;
+      }
+      if(cp->tone == DSIT1 + cp->sit && cp->on >= SIT_MIN)
+        cp->sit++;       /* the next SIT tone in turn */
+      else
+        cp->sit = 0;
+      cp->since = cp->start;
+      cp->off = 0;
+    }
+    if(tone >= 0) {
+      cp->had_off = cp->off > 0;
+      cp->on = 1;
+      cp->start = at;
+    } else if(++cp->off == FLUSH_TIME) {
+      cp->verdict = -1;
+      cp->sit = 0;
+    }
+    cp->tone = tone;
+  }
+  if(v < 0 || v == cp->verdict)
+    return(-1);
+  cp->verdict = v;
+  return(v);
+}
+
+/*
+ * the phase of a 2100 frame at power p, for fax_cadence()
+ *
+ * a phase reversal is a frame whose phase is more than
+ * 90 degrees off where the last one predicts.  the tone
+ * may be a few Hz off the bin, so the phase steps a bit
+ * each frame.  the step is learnt from frames in a row
+ * and taken out before comparing.  frames under half the
+ * peak are the reversal itself and are skipped.
+ */
+ans_phase(cp, z, p, at)
+struct cadence *cp;
+float *z, p;
+long at;
+{
+  float pz[2],t,m;
+  int i,n,r=0;
+
+  if(p > cp->pmax)
+    cp->pmax = p;
+  if(p < 0.5 * cp->pmax)
+    return(0);
+  cp->good++;
+  if(p < AM_LOW * cp->pmax)
+    cp->low++;
+  if(cp->zat >= 0) {
+    n = (at - cp->zat) / N;
+    pz[0] = cp->z[0];
+    pz[1] = cp->z[1];
+    for(i=0; i<n; i++) {
+      t = pz[0] * cp->d[0] - pz[1] * cp->d[1];
+      pz[1] = pz[0] * cp->d[1] + pz[1] * cp->d[0];
+      pz[0] = t;
+    }
+    if(cp->d[0] != 0.0 || cp->d[1] != 0.0)   /* the step is known */
+      r = z[0] * pz[0] + z[1] * pz[1] < 0.0;
+    cp->rev += r;
+    if(n == 1) {         /* the step, z times the conjugate of the last */
+      cp->d[0] = z[0] * cp->z[0] + z[1] * cp->z[1];
+      cp->d[1] = z[1] * cp->z[0] - z[0] * cp->z[1];
+      m = sqrt(cp->d[0] * cp->d[0] + cp->d[1] * cp->d[1]);
+      if(m > 0.0) {
+        cp->d[0] /= r? -m: m;
+        cp->d[1] /= r? -m: m;
+      }
+    }
+  }
+  cp->z[0] = z[0];
+  cp->z[1] = z[1];
+  cp->zat = at;
+  return(0);
+}
+
+/*
+ * fax and modem answer tones by cadence.
+ *
+ *   CNG     1100 on for about 0.5 s (fax calling)
+ *   CED     2100 steady (fax answering, or ANS)
+ *   /ANS    2100 with a phase reversal every 450 ms
+ *   ANSam   2100 amplitude modulated at 15 Hz
+ *   /ANSam  both
+ *
+ * CNG is given as its first burst ends, the 2100 ones
+ * after ANS_MIN frames (by then a /ANS has reversed),
+ * and again if more of the tone changes the verdict.
+ * a reversal may take ANS_GAP frames out of the tone.
+ * ANSam is told by the frame power: 30 ms frames sample
+ * the 15 Hz envelope so that many frames fall well
+ * below the peak, a steady tone has almost none.
+ *
+ * the same arguments and result as cp_cadence()
+ */
+fax_cadence(dp, x, at)
+struct detector *dp;
+int x;
+long at;
+{
+  struct cadence *cp = &dp->cad;
+  int tone, am, v = -1;
+
+  if(x < 0)
+    return(-1);
+  tone = (x == D1100 || x == D2100)? x: -1;
+  if(tone < 0 && cp->tone == D2100 && cp->off < ANS_GAP) {
+    cp->off++;           /* a reversal, or the end */
+    return(-1);
+  }
+  if(tone >= 0 && tone == cp->tone) {
+    cp->on = (at - cp->start)/N + 1;
+    cp->off = 0;
+  } else {
+    if(cp->tone == D1100 && cp->on >= CNG_ON_MIN && cp->on <= CNG_ON_MAX)
+      v = VCNG;
+    cp->since = cp->start;
+    if(tone >= 0) {
+      cp->on = 1;
+      cp->off = 0;
+      cp->start = at;
+      cp->rev = cp->good = cp->low = 0;
+      cp->pmax = 0.0;
+      cp->d[0] = cp->d[1] = 0.0;
+      cp->zat = -1;
+    } else if(++cp->off == FLUSH_TIME)
+      cp->verdict = -1;
+    cp->tone = tone;
+  }
+  if(tone == D2100) {
+    ans_phase(cp, dp->z, dp->peak[0], at);
+    if(cp->on >= ANS_MIN) {
+      am = cp->low * 4 > cp->good;
+      v = cp->rev? (am? VANSPR: VANS): (am? VANSAM: VCED);
+      cp->since = cp->start;
+    }
+  }
+  if(v < 0 || v == cp->verdict)
+    return(-1);
+  cp->verdict = v;
+  return(v);
+}
+
+/*
+ * an event of channel dp, with its current peaks.
+ * the times are of the input, less the resampler's delay
+ */
+set_event(ev, dp, code, start, end)
+struct event *ev;
+struct detector *dp;
+int code;
+long start, end;
+{
+  ev->chan = dp->chan;
+  ev->code = code;
+  ev->flags = 0;
+  ev->start = (start > dp->delay)? start - dp->delay: 0;
+  ev->end = (end > dp->delay)? end - dp->delay: 0;
+  ev->peak[0] = dp->peak[0];
+  ev->peak[1] = dp->peak[1];
+  return(0);
+}
+
+/*
+ * the events, if any, for the result x of the next
+ * frame of channel dp
+ *
+ * returns how many, with the events in ev[]
+ * (MAXEVENTS at most)
+ */
+frame_events(dp, x, ev)
+struct detector *dp;
+int x;
+struct event *ev;
+{
+  struct event *op = &dp->open;
+  int code = next_event(dp, x), v, n = 0;
+  long at = dp->nframe++ * N;
+
+  if(dp->prov >= 0) {    /* the full block on an early decision */
+    set_event(&ev[n], dp, dp->prov, at, at + N);
+    ev[n++].flags = (x == dp->prov)? E_CONFIRM: E_RETRACT;
+    if(x == dp->prov && code == x && !dp->whole)
+      code = -1;         /* it is out already */
+    dp->prov = -1;
+  }
+  if(dp->prof->cadence && (v = (*dp->prof->cadence)(dp, x, at)) >= 0)
+    set_event(&ev[n++], dp, v, dp->cad.since, at + N);
+  if(dp->fsk.ready) {    /* a caller ID came in */
+    set_event(&ev[n], dp, VCID, dp->fsk.start, at + N);
+    ev[n].peak[0] = ev[n].peak[1] = 0.0;
+    strncpy(ev[n++].text, dp->fsk.text, CID_TEXT);
+    dp->fsk.ready = 0;
+  }
+
+  if(!dp->whole) {
+    if(code < 0)
+      return(n);
+    set_event(&ev[n], dp, code, at, at + N);
+    return(n+1);
+  }
+
+  if(x < 0)              /* invalid frames neither end nor extend one */
+    return(n);
+  if(x == op->code) {    /* still on */
+    op->end = at + N - dp->delay;
+    if(dp->peak[0] > op->peak[0]) {
+      op->peak[0] = dp->peak[0];
+      op->peak[1] = dp->peak[1];
+    }
+    return(n);
+  }
+  if(op->code >= 0) {    /* it ended */
+    ev[n++] = *op;
+    op->code = -1;
+  }
+  if(code >= 0 && code != DSIL)
+    set_event(op, dp, code, at, at + N);
+  return(n);
+}
+
+/* the event still going on at the end of the input */
+last_event(dp, ev)
+struct detector *dp;
+struct event *ev;
+{
+  if(dp->spec)
+    spec_end(dp);
+  if(dp->open.code < 0)
+    return(0);
+  *ev = dp->open;
+  dp->open.code = -1;
+  return(1);
+}
+
+/*
+ * early decisions.
+ *
+ * with -e a frame is read in parts and at each of
+ * early_at[] samples the profile's resonators are run
+ * over what there is so far.  a steady tone's power
+ * grows as the square of the samples, so scaled up to
+ * N it is held against THRESH.  a DTMF digit is taken
+ * early when the two strongest tones are a row and a
+ * column within RANGE of each other and every other
+ * tone is EARLY_RATIO below the weaker of them.  it is
+ * output at once (E_EARLY), and the full block, decoded
+ * as always, confirms or retracts it (see frame_events).
+ *
+ * only a digit the text output would print is taken
+ * early, one after silence or a tone.  the partial runs
+ * are extra work on top of the full block.
+ */
+#define EARLY_RATIO  6.0
+
+/* the profile has every DTMF tone */
+has_dtmf(pp)
+struct profile *pp;
+{
+  static int d[] = { R1, R2, R3, R4, C1, C2, C3, C4 };
+  int i,j;
+
+  for(i=0; i<8; i++) {
+    for(j=0; j<pp->ntones && pp->tones[j] != d[i]; j++)
+      ;
+    if(j == pp->ntones)
+      return(0);
+  }
+  return(1);
+}
+
+/*
+ * run the partial resonators of channel dp on to
+ * sample 'to' of 'data'
+ *
+ * returns the digit decided on, or -1
+ */
+early_part(dp, pa, data, to)
+struct detector *dp;
+struct partial *pa;
+#ifdef UNSIGNED
+unsigned char *data;
+#else
+char *data;
+#endif
+int to;
+{
+  struct profile *pp = dp->prof;
+  float power[NUMBANK], p[3], scale;
+  int on[NUMBANK], top[2], i, t;
+
+  if(dp->MFmode || (dp->last != DSIL && dp->last < D24) || !has_dtmf(pp))
+    return(-1);
+  if(!pa->n)
+    for(i=0; i<NUMBANK; i++)
+      pa->u0[i] = pa->u1[i] = 0.0;
+  for(i=pa->n; i<to; i++)
+    pa->x[i] = SAMPLE_TO_FLOAT(data[i]);
+  (*pp->resonate)(pa->x, pa->n, to, pa->u0, pa->u1);
+  pa->n = to;
+  (*pp->power)(pa->u0, pa->u1, power);
+
+  p[0] = p[1] = p[2] = 0.0;
+  top[0] = top[1] = 0;
+  for(i=0; i<NUMBANK; i++)
+    on[i] = 0;
+  for(i=0; i<pp->ntones; i++) {
+    t = pp->tones[i];
+    if(power[t] > p[0]) {
+      p[2] = p[1];  p[1] = p[0];  p[0] = power[t];
+      top[1] = top[0];  top[0] = t;
+    } else if(power[t] > p[1]) {
+      p[2] = p[1];  p[1] = power[t];
+      top[1] = t;
+    } else if(power[t] > p[2])
+      p[2] = power[t];
+  }
+  scale = (float)N * N / ((float)to * to);
+  if(p[0] * scale < dp->thresh || p[1] < dp->lv.range * p[0] ||
+     p[2] * EARLY_RATIO > p[1])
+    return(-1);
+  on[top[0]] = on[top[1]] = 1;
+  if((i = dtmf_pair(on)) < 0)
+    return(-1);
+  if(pp->nbank > pp->ntones && dp->lv.harm > 0.0 &&    /* talk-off */
+     (power[harm[top[0]]] > dp->lv.harm * p[0] ||
+      power[harm[top[1]]] > dp->lv.harm * p[1]))
+    return(-1);
+  dp->peak[0] = p[0] * scale;
+  dp->peak[1] = p[1] * scale;
+  return(dtmf_digit(i/4, i%4));
+}
+
+/* the tables of the classifier and of caller ID */
+void det_lib_init()
+{
+  class_init();
+  fsk_init();
+}
+
+/*
+ * feed n samples of 'data', any number, to channel dp.
+ * what is left of a frame is kept for the next call.
+ * the events go to ev[], *nev of them.  it stops short
+ * while fewer than MAXEVENTS of the maxev are free, the
+ * rest is for the next call.
+ *
+ * returns the samples taken
+ */
+long det_feed(dp, data, n, ev, maxev, nev)
+struct detector *dp;
+const char *data;
+long n;
+struct event *ev;
+int maxev, *nev;
+{
+  char *frame;
+  long used = 0, m;
+  int x;
+  M_VAR(t);
+
+  *nev = 0;
+  while(used < n && maxev - *nev >= MAXEVENTS) {
+    if(dp->have || n - used < N) {
+      m = (N - dp->have < n - used)? N - dp->have: n - used;
+      memcpy(dp->part + dp->have, data + used, m);
+      used += m;
+      if((dp->have += m) < N)
+        break;
+      dp->have = 0;
+      frame = dp->part;
+    } else {
+      frame = (char *)data + used;
+      used += N;
+    }
+    M_START(t);
+    x = decode(dp, frame);
+    M_STAGE(S_DECODE, t);
+    M_RESULT(x);
+    *nev += frame_events(dp, x, ev + *nev);
+  }
+  return(used);
+}
+
+/*
+ * the end of the input of channel dp, a part frame
+ * is dropped.  returns the tone still on, if any,
+ * as for last_event
+ */
+det_end(dp, ev)
+struct detector *dp;
+struct event *ev;
+{
+  dp->have = 0;
+  return(last_event(dp, ev));
+}
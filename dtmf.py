@@ -0,0 +1,51 @@
+"""
+dtmf.py
+the detector over arrays, see dtmfmodule.c.
+
+    import dtmf
+    ev = dtmf.decode(samples, profile="dtmf")
+    digits = "".join(dtmf.names[c] for c in ev["code"])
+    p = dtmf.power(samples)
+
+samples are any buffer of uint8, int8, int16, float32 or
+float64 at 8 kHz, (samples,) or (samples, channels), and
+are not copied.  with numpy the events are a structured
+array of EVENT and the powers an array, without it a list
+of tuples and a memoryview.
+"""
+import struct
+
+import _dtmf
+
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
+N = _dtmf.N                  # samples in a frame
+FSAMPLE = _dtmf.FSAMPLE
+names = _dtmf.names          # the codes, as detect -f json has them
+freqs = _dtmf.freqs          # of power()'s columns
+
+# struct pyevent, in the host's byte order
+EVENT = [("chan", "i4"), ("code", "i4"), ("start", "i8"), ("end", "i8"),
+         ("peak", "f4", (2,)), ("text", "S64")]
+_EVENT = struct.Struct("=iiqqff64s")
+assert _EVENT.size == _dtmf.EVENT_SIZE
+
+
+def decode(samples, profile="full", callerid=False, levels=""):
+    """the whole tones of every channel, start and end in samples.
+    levels as for detect -L, "adapt=20,twist=8,rtwist=4,share=0.6"
+    """
+    raw = _dtmf.decode(samples, profile, callerid, levels)
+    if numpy is not None:
+        return numpy.frombuffer(raw, dtype=EVENT)
+    return [(c, code, s, e, (p0, p1), t.rstrip(b"\0"))
+            for c, code, s, e, p0, p1, t in _EVENT.iter_unpack(raw)]
+
+
+def power(samples):
+    """the power of each tone in each frame, frames by tones"""
+    m = _dtmf.power(samples)
+    return numpy.asarray(m) if numpy is not None else m
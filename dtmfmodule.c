@@ -0,0 +1,295 @@
+/*
+ * dtmfmodule.c
+ * python bindings of the detector, for analysis over
+ * arrays without temp files or a detect process.
+ *
+ *    make python
+ *
+ * builds _dtmf, dtmf.py puts it in numpy's terms.  the
+ * samples are any buffer (bytes, array.array, a numpy
+ * array) of uint8, int8, int16, float32 or float64, a
+ * channel of them or (samples, channels), and they are
+ * read where they are, a frame at a time, with the GIL
+ * let go.  unlike detect the format is the buffer's, not
+ * the library's -DUNSIGNED: uint8 is unsigned, int8
+ * signed.
+ *
+ *    _dtmf.decode(samples, profile="full", callerid=0, levels="")
+ *
+ * the events of every channel as bytes, a struct pyevent
+ * each, whole tones as detect -f bin has them.  levels
+ * are as for detect -L.
+ *
+ *    _dtmf.power(samples)
+ *
+ * the power of the NUMTONES tones of the classic bank in
+ * each frame (see calc_power), a float32 memoryview of
+ * (frames, NUMTONES), or (channels, frames, NUMTONES).
+ */
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <stdlib.h>
+#include <string.h>
+#include "detect.h"
+
+/* an event as decode() gives it, dtmf.EVENT */
+struct pyevent {
+  int chan;
+  int code;
+  long long start, end;
+  float peak[2];
+  char text[CID_TEXT];   /* a VCID's, else empty */
+};
+
+/* the samples of a buffer */
+struct samples {
+  char *buf;
+  int fmt;               /* B, b, h, f or d as in struct */
+  Py_ssize_t n;          /* samples of a channel */
+  Py_ssize_t nchan;
+  Py_ssize_t step;       /* bytes from a sample to the next */
+  Py_ssize_t cstep;      /* and from a channel to the next */
+};
+
+/* the events so far */
+struct events {
+  struct pyevent *ev;
+  long n, size;
+};
+
+/*
+ * the samples of the buffer in view, 0 if they are
+ * none of the formats (with the exception set)
+ */
+static int get_samples(Py_buffer *view, struct samples *sp)
+{
+  char *f = view->format? view->format: "B";
+
+  if(*f == '@' || *f == '=' || *f == '<')
+    f++;
+  if(!*f || f[1] || !strchr("Bbhfd", *f)) {
+    PyErr_Format(PyExc_ValueError, "samples of format '%s'", view->format);
+    return(0);
+  }
+  if(view->ndim < 1 || view->ndim > 2) {
+    PyErr_SetString(PyExc_ValueError,
+                    "samples are (samples,) or (samples, channels)");
+    return(0);
+  }
+  sp->buf = (char *)view->buf;
+  sp->fmt = *f;
+  sp->n = view->shape[0];
+  sp->step = view->strides[0];
+  sp->nchan = (view->ndim == 2)? view->shape[1]: 1;
+  sp->cstep = (view->ndim == 2)? view->strides[1]: 0;
+  return(1);
+}
+
+/* frame 'at' of channel c of sp into x, as floats */
+static void get_frame(struct samples *sp, Py_ssize_t c, Py_ssize_t at,
+                      float *x)
+{
+  char *p = sp->buf + c * sp->cstep + at * N * sp->step;
+  int i;
+
+  switch(sp->fmt) {
+    case 'B':
+      for(i=0; i<N; i++, p += sp->step)
+        x[i] = ((int)*(unsigned char *)p - 128) / 128.0;
+      break;
+    case 'b':
+      for(i=0; i<N; i++, p += sp->step)
+        x[i] = *(signed char *)p / 128.0;
+      break;
+    case 'h':
+      for(i=0; i<N; i++, p += sp->step)
+        x[i] = *(short *)p / 32768.0;
+      break;
+    case 'f':
+      for(i=0; i<N; i++, p += sp->step)
+        x[i] = *(float *)p;
+      break;
+    case 'd':
+      for(i=0; i<N; i++, p += sp->step)
+        x[i] = *(double *)p;
+      break;
+  }
+}
+
+/* add the n events e[] to ep, 0 if out of memory */
+static int add_events(struct events *ep, struct event *e, int n)
+{
+  struct pyevent *pe;
+  int i;
+
+  if(ep->n + n > ep->size) {
+    ep->size = ep->size? 2 * ep->size: 256;
+    if(!(pe = (struct pyevent *)realloc(ep->ev, ep->size * sizeof(*pe))))
+      return(0);
+    ep->ev = pe;
+  }
+  for(i=0; i<n; i++) {
+    pe = &ep->ev[ep->n++];
+    memset(pe, 0, sizeof(*pe));
+    pe->chan = e[i].chan;
+    pe->code = e[i].code;
+    pe->start = e[i].start;
+    pe->end = e[i].end;
+    pe->peak[0] = e[i].peak[0];
+    pe->peak[1] = e[i].peak[1];
+    if(e[i].code == VCID)
+      memcpy(pe->text, e[i].text, CID_TEXT);
+  }
+  return(1);
+}
+
+static PyObject *py_decode(PyObject *self, PyObject *args, PyObject *kw)
+{
+  static char *kwlist[] = { "samples", "profile", "callerid", "levels", 0 };
+  PyObject *obj, *out;
+  Py_buffer view;
+  struct samples s;
+  struct events evs;
+  struct profile *pp;
+  struct levels lv;
+  struct detector d;
+  struct event e[MAXEVENTS];
+  float x[N];
+  char *profile = "full", *levels = "";
+  int callerid = 0, ok = 1, n;
+  Py_ssize_t c, f;
+
+  if(!PyArg_ParseTupleAndKeywords(args, kw, "O|sps", kwlist,
+                                  &obj, &profile, &callerid, &levels))
+    return(0);
+  if(!(pp = find_profile(profile)))
+    return(PyErr_Format(PyExc_ValueError, "no profile '%s'", profile));
+  levels_init(&lv);
+  if(levels_parse(&lv, levels) < 0)
+    return(PyErr_Format(PyExc_ValueError, "levels '%s'", levels));
+  if(PyObject_GetBuffer(obj, &view, PyBUF_RECORDS_RO) < 0)
+    return(0);
+  if(!get_samples(&view, &s)) {
+    PyBuffer_Release(&view);
+    return(0);
+  }
+  evs.ev = 0;
+  evs.n = evs.size = 0;
+  Py_BEGIN_ALLOW_THREADS
+  for(c=0; c<s.nchan && ok; c++) {
+    det_init(&d, pp, (int)c);
+    d.whole = 1;
+    d.callerid = callerid;
+    det_levels(&d, &lv);
+    for(f=0; f<s.n/N && ok; f++) {
+      get_frame(&s, c, f, x);
+      n = frame_events(&d, decode_float(&d, x), e);
+      ok = add_events(&evs, e, n);
+    }
+    if(ok)
+      ok = add_events(&evs, e, last_event(&d, e));
+  }
+  Py_END_ALLOW_THREADS
+  PyBuffer_Release(&view);
+  if(!ok) {
+    free(evs.ev);
+    return(PyErr_NoMemory());
+  }
+  out = PyBytes_FromStringAndSize((char *)evs.ev,
+                                  evs.n * sizeof(struct pyevent));
+  free(evs.ev);
+  return(out);
+}
+
+static PyObject *py_power(PyObject *self, PyObject *obj)
+{
+  PyObject *out, *view_out, *shape;
+  Py_buffer view;
+  struct samples s;
+  float x[N], power[NUMBANK], *to;
+  Py_ssize_t c, f, nframe;
+
+  if(PyObject_GetBuffer(obj, &view, PyBUF_RECORDS_RO) < 0)
+    return(0);
+  if(!get_samples(&view, &s)) {
+    PyBuffer_Release(&view);
+    return(0);
+  }
+  nframe = s.n / N;
+  if(!(out = PyBytes_FromStringAndSize(0,
+                          s.nchan * nframe * NUMTONES * sizeof(float)))) {
+    PyBuffer_Release(&view);
+    return(0);
+  }
+  to = (float *)PyBytes_AS_STRING(out);
+  Py_BEGIN_ALLOW_THREADS
+  for(c=0; c<s.nchan; c++)
+    for(f=0; f<nframe; f++, to += NUMTONES) {
+      get_frame(&s, c, f, x);
+      calc_power_float(x, power);
+      memcpy(to, power, NUMTONES * sizeof(float));
+    }
+  Py_END_ALLOW_THREADS
+  PyBuffer_Release(&view);
+
+  if(s.nchan > 1)
+    shape = Py_BuildValue("(nni)", s.nchan, nframe, NUMTONES);
+  else
+    shape = Py_BuildValue("(ni)", nframe, NUMTONES);
+  view_out = PyMemoryView_FromObject(out);
+  Py_DECREF(out);
+  if(!shape || !view_out) {
+    Py_XDECREF(shape);
+    Py_XDECREF(view_out);
+    return(0);
+  }
+  out = PyObject_CallMethod(view_out, "cast", "sO", "f", shape);
+  Py_DECREF(view_out);
+  Py_DECREF(shape);
+  return(out);
+}
+
+static PyMethodDef methods[] = {
+  { "decode", (PyCFunction)py_decode, METH_VARARGS | METH_KEYWORDS,
+    "decode(samples, profile='full', callerid=False, levels='') -> events "
+    "as bytes" },
+  { "power", py_power, METH_O,
+    "power(samples) -> float32 memoryview, the power of each tone a frame" },
+  { 0 } };
+
+static struct PyModuleDef module = {
+  PyModuleDef_HEAD_INIT, "_dtmf", "the DTMF detector, see dtmf.py", -1,
+  methods };
+
+PyMODINIT_FUNC PyInit__dtmf(void)
+{
+  PyObject *m, *names, *freqs;
+  char buf[32], *p, *q;
+  int i;
+
+  det_lib_init();
+  if(!(m = PyModule_Create(&module)))
+    return(0);
+  names = PyList_New(VCID+1);      /* the codes, as detect -f json */
+  for(i=0; names && i<=VCID; i++) {
+    for(p=dtran[i]; *p == ' ' || *p == '+'; p++)
+      ;
+    strncpy(buf, p, sizeof(buf)-1);
+    buf[sizeof(buf)-1] = '\0';
+    for(q=buf+strlen(buf); q > buf && (q[-1] == ' ' || q[-1] == '+'); )
+      *--q = '\0';
+    PyList_SET_ITEM(names, i, PyUnicode_FromString(buf));
+  }
+  freqs = PyList_New(NUMTONES);    /* of power()'s columns */
+  for(i=0; freqs && i<NUMTONES; i++)
+    PyList_SET_ITEM(freqs, i, PyFloat_FromDouble((double)k[i] * FSAMPLE / N));
+  if(!names || !freqs || PyModule_AddObject(m, "names", names) < 0 ||
+     PyModule_AddObject(m, "freqs", freqs) < 0 ||
+     PyModule_AddIntConstant(m, "N", N) < 0 ||
+     PyModule_AddIntConstant(m, "FSAMPLE", FSAMPLE) < 0 ||
+     PyModule_AddIntConstant(m, "EVENT_SIZE", sizeof(struct pyevent)) < 0) {
+    Py_DECREF(m);
+    return(0);
+  }
+  return(m);
+}
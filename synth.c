@@ -0,0 +1,144 @@
+/*
+ * synth.c
+ * the tone generator as a library, see synth.h.  these
+ * are gen.c's two_tones(), silence() and fsk_bits()
+ * made to fill the caller's buffers a piece at a time,
+ * sample for sample the same.
+ *
+ *    cc -c synth.c
+ */
+
+#include "synth.h"
+
+/*
+ * FLOAT_TO_SAMPLE converts a float in the range -1.0 to 1.0
+ * into a format valid to be written out in a sound file
+ * or to a sound device
+ */
+#ifdef SIGNED
+#  define FLOAT_TO_SAMPLE(x)    ((char)((x) * 127.0))
+#else
+#  define FLOAT_TO_SAMPLE(x)    ((char)((x + 1.0) * 127.0))
+#endif
+
+/*
+ * take the sine of x, where x is 0 to 65535 (for 0 to 360 degrees)
+ */
+static float mysine(short in)
+{
+  static coef[] = {
+     3.140625, 0.02026367, -5.325196, 0.5446778, 1.800293 };
+  float x,y,res;
+  int sign,i;
+
+  if(in < 0) {       /* force positive */
+    sign = -1;
+    in = -in;
+  } else
+    sign = 1;
+  if(in >= 0x4000)      /* 90 degrees */
+    in = 0x8000 - in;   /* 180 degrees - in */
+  x = in * (1/32768.0);
+  y = x;               /* y holds x^i) */
+  res = 0;
+  for(i=0; i<5; i++) {
+    res += y * coef[i];
+    y *= x;
+  }
+  return(res * sign);
+}
+
+void synth_init(sp)
+struct synth *sp;
+{
+  sp->what = SYNTH_SILENCE;
+  sp->left = 0;
+  sp->fc = 0;
+  sp->nbits = 0;
+  sp->nbit = 0;
+}
+
+/*
+ * tone1 and tone2 (in Hz) for 'length' milliseconds,
+ * each from phase 0
+ */
+void synth_tones(sp, tone1, tone2, length)
+struct synth *sp;
+unsigned int tone1, tone2, length;
+{
+  sp->what = SYNTH_TONES;
+  sp->ad[0] = (tone1 << 16) / SYNTH_RATE;
+  sp->ad[1] = (tone2 << 16) / SYNTH_RATE;
+  sp->c[0] = sp->c[1] = 0;
+  sp->left = (length * SYNTH_RATE) / 1000;
+}
+
+/* silence for 'length' milliseconds */
+void synth_silence(sp, length)
+struct synth *sp;
+unsigned int length;
+{
+  sp->what = SYNTH_SILENCE;
+  sp->left = (length * SYNTH_RATE) / 1000;
+}
+
+/*
+ * bell 202 FSK at 1200 baud, the low n bits of 'bits'
+ * (32 at most), lsb first.  the phase carries on from
+ * one call to the next
+ */
+void synth_fsk(sp, bits, n)
+struct synth *sp;
+unsigned int bits;
+int n;
+{
+  sp->what = SYNTH_FSK;
+  sp->bits = bits;
+  sp->nbits = n;
+  sp->left = 0;
+}
+
+/*
+ * up to n samples of what was asked for into buf
+ *
+ * returns how many, 0 once it is all out
+ */
+long synth_run(sp, buf, n)
+struct synth *sp;
+char *buf;
+long n;
+{
+  float out;
+  long i;
+
+  for(i=0; i<n; i++) {
+    if(sp->what == SYNTH_FSK && !sp->left && sp->nbits > 0) {
+      sp->ad[0] = (((sp->bits & 1)? SYNTH_MARK: SYNTH_SPACE) << 16) /
+                  SYNTH_RATE;
+      /* 6 2/3 samples a bit, kept in step with the baud rate */
+      sp->left = ((sp->nbit+1) * SYNTH_RATE) / SYNTH_BAUD -
+                 (sp->nbit * SYNTH_RATE) / SYNTH_BAUD;
+      sp->bits >>= 1;
+      sp->nbits--;
+      sp->nbit++;
+    }
+    if(!sp->left)
+      break;
+    switch(sp->what) {
+      case SYNTH_TONES:
+        out = (mysine(sp->c[0]) + mysine(sp->c[1])) * 0.5;
+        buf[i] = FLOAT_TO_SAMPLE(out);
+        sp->c[0] += sp->ad[0];
+        sp->c[1] += sp->ad[1];
+        break;
+      case SYNTH_FSK:
+        buf[i] = FLOAT_TO_SAMPLE(mysine(sp->fc) * 0.5);
+        sp->fc += sp->ad[0];
+        break;
+      default:
+        buf[i] = FLOAT_TO_SAMPLE(0.0);
+    }
+    sp->left--;
+  }
+  return(i);
+}
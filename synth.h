@@ -0,0 +1,60 @@
+/*
+ * synth.h
+ * the tone generator as a library, the other half of
+ * detect.h.  gen is built on it.
+ *
+ * a struct synth is the caller's and so are the sample
+ * buffers, nothing is allocated.  a tone, a silence or
+ * some FSK bits are asked for, then synth_run() fills
+ * buffers with them until it returns 0:
+ *
+ *    struct synth s;
+ *    char buf[128];
+ *
+ *    synth_init(&s);
+ *    synth_tones(&s, 697, 1209, 50);
+ *    while((n = synth_run(&s, buf, sizeof(buf))) > 0)
+ *      write(fd, buf, n);
+ *
+ * samples are 8 bit at 8 kHz, unsigned, or signed with
+ * -DSIGNED, as gen.c always made them.
+ */
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SYNTH_RATE   8000   /* sampling rate, 8KHz */
+#define SYNTH_MARK   1200   /* bell 202, mark (1) */
+#define SYNTH_SPACE  2200   /* and space (0) */
+#define SYNTH_BAUD   1200
+
+#define SYNTH_SILENCE 0     /* what it is making */
+#define SYNTH_TONES  1
+#define SYNTH_FSK    2
+
+struct synth {
+  int what;              /* SYNTH_SILENCE, _TONES or _FSK */
+  long left;             /* samples of it to go */
+  unsigned short c[2];   /* phase of the tones, 0 to 65535 for 360 degrees */
+  unsigned int ad[2];    /* and the step per sample */
+  unsigned short fc;     /* phase of the FSK, kept from call to call */
+  unsigned int bits;     /* FSK bits to go, lsb first */
+  int nbits;
+  long nbit;             /* FSK bits sent, for the baud clock */
+};
+
+void synth_init(struct synth *sp);
+void synth_tones(struct synth *sp, unsigned int tone1, unsigned int tone2,
+                 unsigned int length);
+void synth_silence(struct synth *sp, unsigned int length);
+void synth_fsk(struct synth *sp, unsigned int bits, int n);
+long synth_run(struct synth *sp, char *buf, long n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SYNTH_H */